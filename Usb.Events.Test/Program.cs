@@ -9,7 +9,7 @@ namespace Usb.Events.Test
         {
             IUsbEventWatcher usbEventWatcher = new UsbEventWatcher(startImmediately: true, addAlreadyPresentDevicesToList: true, usePnPEntity: true);
 
-            foreach (UsbDevice device in usbEventWatcher.UsbDeviceList)
+            foreach (UsbDevice device in usbEventWatcher.Devices)
             {
                 Console.WriteLine(device + Environment.NewLine);
             }
@@ -1,5 +1,6 @@
 ﻿using System;
 using System.Collections.Generic;
+using System.Threading.Channels;
 
 namespace Usb.Events
 {
@@ -14,10 +15,21 @@ namespace Usb.Events
         List<string> UsbDrivePathList { get; }
 
         /// <summary>
-        /// List of USB devices
+        /// Copy of Devices.Snapshot: it is no longer the live list of the watcher, every call allocates a new list and changing it has no effect
         /// </summary>
+        [Obsolete("UsbDeviceList is a copy that is not updated and ignores changes, use Devices instead")]
         List<UsbDevice> UsbDeviceList { get; }
 
+        /// <summary>
+        /// Present USB devices, with lock-free snapshots and lookups by system path, device name, serial number and vendor/product ID
+        /// </summary>
+        UsbDeviceRegistry Devices { get; }
+
+        /// <summary>
+        /// Reader of all events when UsbEventWatcherOptions.EventChannelCapacity is set, completed when the watcher is disposed
+        /// </summary>
+        ChannelReader<UsbEvent>? EventReader { get; }
+
         /// <summary>
         /// USB drive mounted event
         /// </summary>
@@ -38,12 +50,29 @@ namespace Usb.Events
         /// </summary>
         event EventHandler<UsbDevice>? UsbDeviceRemoved;
 
+        /// <summary>
+        /// USB devices changed event, raised once for all the devices added or removed together
+        /// </summary>
+        event EventHandler<IReadOnlyList<UsbDeviceChange>>? UsbDevicesChanged;
+
         /// <summary>
         /// Start monitoring USB events
         /// </summary>
-        /// <param name="addAlreadyPresentDevicesToList">Set addAlreadyPresentDevicesToList to true to include already present devices in UsbDeviceList</param>
+        /// <param name="addAlreadyPresentDevicesToList">Set addAlreadyPresentDevicesToList to true to include already present devices in Devices</param>
         /// <param name="usePnPEntity">Set usePnPEntity to true to query Win32_PnPEntity instead of Win32_USBControllerDevice in Windows</param>
         /// <param name="includeTTY">Set includeTTY to true to monitor the TTY subsystem in Linux (besides the USB subsystem)</param>
         void Start(bool addAlreadyPresentDevicesToList = false, bool usePnPEntity = false, bool includeTTY = false);
+
+        /// <summary>
+        /// Start monitoring USB events
+        /// </summary>
+        /// <param name="options">Watcher options</param>
+        void Start(UsbEventWatcherOptions options);
+
+        /// <summary>
+        /// Get the devices that are present now, in one call and without raising events
+        /// </summary>
+        /// <returns>In Linux the devices enumerated with the device selection of the running watcher, otherwise Devices.Snapshot</returns>
+        IReadOnlyList<UsbDevice> GetSnapshot();
     }
 }
@@ -1,42 +1,282 @@
-#define _POSIX_C_SOURCE 199309L
+#define _GNU_SOURCE
 #include <time.h>
 #include <errno.h>
 #include <libudev.h>
-#include <mntent.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/select.h>
-
-typedef struct UsbDeviceData
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/sysmacros.h>
+#include <sys/timerfd.h>
+
+// Fields of a UsbDeviceRecord
+typedef enum UsbDeviceField
+{
+    UsbDeviceFieldDeviceName,
+    UsbDeviceFieldDeviceSystemPath,
+    UsbDeviceFieldProduct,
+    UsbDeviceFieldProductDescription,
+    UsbDeviceFieldProductID,
+    UsbDeviceFieldSerialNumber,
+    UsbDeviceFieldVendor,
+    UsbDeviceFieldVendorDescription,
+    UsbDeviceFieldVendorID,
+    UsbDeviceFieldCount
+} UsbDeviceField;
+
+// Field mask bits, one per UsbDeviceField
+#define USB_DEVICE_FIELD_BIT(field) (1u << (field))
+#define USB_DEVICE_FIELD_MASK_ALL ((1u << UsbDeviceFieldCount) - 1)
+
+// The device name and system path identify a device in the tracked list and in the managed device list, so they are always fetched
+#define USB_DEVICE_FIELD_MASK_REQUIRED (USB_DEVICE_FIELD_BIT(UsbDeviceFieldDeviceName) | USB_DEVICE_FIELD_BIT(UsbDeviceFieldDeviceSystemPath))
+
+// Compact device record: this header is directly followed by the NUL-terminated UTF-8 values of the fields that are set
+typedef struct UsbDeviceRecord
 {
-    char DeviceName[512];
-    char DeviceSystemPath[1024];
-    char Product[512];
-    char ProductDescription[512];
-    char ProductID[512];
-    char SerialNumber[512];
-    char Vendor[512];
-    char VendorDescription[512];
-    char VendorID[512];
-} UsbDeviceData;
+    uint32_t Size;          // Header and values, in bytes
+    struct
+    {
+        uint16_t Offset;    // From the start of the record, 0 if the field is not set
+        uint16_t Length;    // Without the terminating NUL
+    } Fields[UsbDeviceFieldCount];
+} UsbDeviceRecord;
 
-UsbDeviceData usbDevice;
+// Values are truncated to the sizes of the former fixed UsbDeviceData arrays, 1024 bytes for the system path and 512 for the others
+#define USB_DEVICE_RECORD_MAX_SIZE (sizeof(UsbDeviceRecord) + 1024 + (UsbDeviceFieldCount - 1) * 512)
 
-static const struct UsbDeviceData empty;
+typedef union UsbDeviceRecordBuffer
+{
+    UsbDeviceRecord record;
+    unsigned char bytes[USB_DEVICE_RECORD_MAX_SIZE];
+} UsbDeviceRecordBuffer;
 
-typedef void (*UsbDeviceCallback)(UsbDeviceData usbDevice);
-UsbDeviceCallback InsertedCallback;
-UsbDeviceCallback RemovedCallback;
+typedef void (*UsbDeviceCallback)(const UsbDeviceRecord* usbDevice);
 
 typedef void (*MountPointCallback)(const char* mountPoint);
+typedef void (*MountPointChangedCallback)(const char* syspath, const char* mountPoint);
+
+// One entry of a batch, Kind is a WatcherEventKind (inserted or removed)
+typedef struct UsbDeviceEvent
+{
+    int32_t Kind;
+    const UsbDeviceRecord* Record;
+} UsbDeviceEvent;
+
+typedef void (*UsbDeviceBatchCallback)(const UsbDeviceEvent* events, int count);
+
+// Devices reported as inserted, with the mount point that was last reported for each of them
+typedef struct TrackedDevice
+{
+    char* syspath;
+    char* mountPoint;
+    UsbDeviceRecord* record;    // Copy of the reported record, it is reported again if a resync finds the device gone
+    int seen;                   // Found by the current enumeration
+    struct TrackedDevice* next;
+} TrackedDevice;
+
+typedef struct EventSource EventSource;
+
+typedef void (*EventSourceHandler)(EventSource* source, uint32_t events);
+
+struct EventSource
+{
+    int fd;
+    EventSourceHandler handler;
+    void* data;
+};
+
+typedef struct EventLoop
+{
+    int epollfd;
+    volatile int running;
+} EventLoop;
+
+// Device filter, the devtype and tags are installed in the kernel socket filter of the monitor
+#define DEVICE_FILTER_MAX_TAGS 16
+#define DEVICE_FILTER_MAX_IDS 64
 
-volatile int runLinuxWatcher = 0;
+typedef struct DeviceId
+{
+    uint16_t vendorId;
+    int32_t productId;      // -1 matches every product of the vendor
+} DeviceId;
+
+typedef struct DeviceFilter
+{
+    char devtype[64];       // Devtype in the usb subsystem, "" matches all of them
+    char tags[DEVICE_FILTER_MAX_TAGS][64];
+    int tagCount;           // A device must have one of the tags, 0 matches all devices
+    DeviceId ids[DEVICE_FILTER_MAX_IDS];
+    int idCount;            // A device must match one of the IDs, 0 matches all devices
+} DeviceFilter;
+
+// Devices with add/remove events inside the debounce window, only the net state is reported when the window ends
+typedef struct PendingDevice
+{
+    char* syspath;
+    int added;                  // State after the last raw event
+    unsigned int rawEvents;
+    uint64_t deadline;          // CLOCK_MONOTONIC milliseconds, moved on with every raw event
+    uint64_t receivedUs;        // Receive time of the last raw event
+    UsbDeviceRecord* record;    // Copy of the record of the last raw event
+    struct PendingDevice* next;
+} PendingDevice;
+
+// Event queue: a bounded single-producer single-consumer ring between the event loop thread and one reader thread,
+// so that a slow consumer does not stall udev_monitor_receive_device
+
+typedef enum WatcherEventKind
+{
+    WatcherEventNone,
+    WatcherEventInserted,
+    WatcherEventRemoved,
+    WatcherEventMountPointChanged   // The data holds the NUL-terminated syspath followed by the NUL-terminated mount point
+} WatcherEventKind;
+
+typedef enum QueueOverflowPolicy
+{
+    QueueOverflowDropOldest,        // The oldest queued event is discarded
+    QueueOverflowBlock,             // The event loop waits until the reader frees a slot
+    QueueOverflowCoalesce           // Events wait outside the ring, the newest one per device and kind replaces older ones
+} QueueOverflowPolicy;
 
-int pipefd[2];
+typedef struct WatcherEvent
+{
+    uint32_t kind;
+    uint32_t size;                  // Of the data, in bytes
+    uint64_t receivedUs;            // CLOCK_MONOTONIC microseconds of the receive, 0 for enumerated devices and mount point changes
+    UsbDeviceRecordBuffer data;
+} WatcherEvent;
+
+// Events of the coalesce policy that did not fit into the ring, in arrival order
+typedef struct OverflowEvent
+{
+    WatcherEvent event;
+    struct OverflowEvent* next;
+} OverflowEvent;
 
-struct udev* g_udev;
+typedef struct EventQueue
+{
+    WatcherEvent* slots;            // Preallocated, NULL if the queue is disabled
+    uint32_t capacity;              // Power of two
+    QueueOverflowPolicy policy;
+    uint32_t head;                  // Next slot to write, only written by the producer
+    uint32_t tail;                  // Next slot to read, moved with CAS by the reader and by a drop-oldest producer
+    int readfd;                     // eventfd that wakes a waiting reader
+    int spacefd;                    // eventfd that wakes a waiting producer
+    int readerWaiting;
+    int producerWaiting;
+    int stopped;
+    uint64_t overflows;             // Events that found the ring full
+    uint64_t dropped;               // Events that were discarded, the overflows of the block policy are only discarded when stopping
+    uint64_t coalesced;             // Events of the coalesce policy that were replaced by a newer one
+    OverflowEvent* overflow;        // Only used by the producer
+} EventQueue;
+
+// Statistics: counters and latency histograms of a watcher, updated with __atomic builtins so that they can be read while it runs
+
+// Log-linear latency buckets in microseconds, like an HDR histogram with two significant bits: values below 4 have a bucket each,
+// every power of two above is split into 4 buckets, the last bucket also counts everything above its range (about 2 hours)
+#define LATENCY_SUB_BUCKET_BITS 2
+#define LATENCY_BUCKETS 128
+
+typedef struct WatcherStats
+{
+    uint64_t EventsReceived;        // Messages read from the udev monitor
+    uint64_t EventsFiltered;        // Not reported: no device node, not matching the filter, or an action other than add/remove
+    uint64_t EventsCoalesced;       // Folded into their usb_device, or replaced in the event queue by a newer event
+    uint64_t EventsSuppressed;      // Collapsed by the debounce window
+    uint64_t EventsDropped;         // Discarded by the event queue
+    uint64_t EventsDispatched;      // Device events passed to the application, including enumerated devices
+    uint64_t Resyncs;
+    uint64_t AddActions;            // Received events by action
+    uint64_t RemoveActions;
+    uint64_t ChangeActions;
+    uint64_t BindActions;
+    uint64_t UnbindActions;
+    uint64_t OtherActions;
+    uint64_t InitializedLatency[LATENCY_BUCKETS];   // Add events, from udev initializing the device to receive
+    uint64_t DispatchLatency[LATENCY_BUCKETS];      // Received events, from receive to dispatch (including a debounce window and the event queue)
+} WatcherStats;
+
+// Batch delivery: the device events of one wakeup are collected and passed to the batch callback in one call
+#define DEVICE_BATCH_MAX_EVENTS 256
+
+typedef struct DeviceBatch
+{
+    UsbDeviceEvent events[DEVICE_BATCH_MAX_EVENTS];
+    size_t offsets[DEVICE_BATCH_MAX_EVENTS];    // Of the records in data, turned into pointers when the batch is delivered
+    uint64_t receivedUs[DEVICE_BATCH_MAX_EVENTS];
+    int count;
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+} DeviceBatch;
+
+// Event log: the properties of received udev messages, recorded for a deterministic replay through the same pipeline
+// The file starts with EVENT_LOG_MAGIC, each record is a 12-byte header (uint64_t CLOCK_MONOTONIC receive time in microseconds,
+// uint32_t size) followed by size bytes of NUL-terminated KEY=VALUE properties, all in host byte order
+#define EVENT_LOG_MAGIC "USBEVLG1"
+#define EVENT_LOG_HEADER_SIZE 12
+
+typedef struct EventReplay
+{
+    FILE* file;                 // Replayed instead of enumerating and monitoring the host devices, NULL if there is none
+    int maxSpeed;               // Replay as fast as possible instead of at the recorded pace
+    int finished;
+    int pending;                // A record was read but is not due yet
+    uint64_t recordUs;          // Receive time of the record that was read
+    uint64_t firstUs;           // Receive time of the first record
+    uint64_t startUs;           // When the first record was replayed
+    char* data;                 // Properties of the record, NUL-terminated KEY=VALUE strings
+    uint32_t size;
+    uint32_t capacity;
+    const char** properties;    // Pointers into data
+    int propertyCount;
+    int propertyCapacity;
+} EventReplay;
+
+// Context struct to hold the state of one watcher, so that several watchers can run in one process
+typedef struct WatcherContext
+{
+    UsbDeviceCallback InsertedCallback;
+    UsbDeviceCallback RemovedCallback;
+    MountPointChangedCallback MountChangedCallback;
+    UsbDeviceBatchCallback BatchCallback;
+    DeviceBatch batch;
+    int includeTTY;
+    uint32_t fieldMask;
+    DeviceFilter filter;
+    int coalesceDevices;
+    int enumerationThreads;
+    int sysfsfd;                // /sys, for the sysfs fast path, -1 if it is disabled
+    long debounceMs;
+    EventSource* debounceTimer;
+    PendingDevice* pendingDevices;
+    uint64_t suppressedEvents;  // Raw events that were not reported, updated with __atomic builtins
+    EventQueue queue;
+    WatcherEvent queueEvent;    // Staging buffer of the producer
+    int receiveBufferSize;
+    uint64_t resyncs;           // Updated with __atomic builtins
+    WatcherStats stats;         // Updated with __atomic builtins, the three counters above and those of the queue are added when it is read
+    uint64_t receivedUs;        // Receive time of the event that is being reported, 0 for enumerated devices
+    FILE* recordFile;           // Event log that received messages are appended to, NULL if they are not recorded
+    EventReplay replay;
+    struct udev* udev;
+    struct udev_monitor* monitor;
+    EventLoop loop;
+    int stopfd;
+    UsbDeviceRecordBuffer usbDevice;
+    TrackedDevice* trackedDevices;
+} WatcherContext;
 
 struct udev_device* GetChild(struct udev* udev, struct udev_device* parent, const char* subsystem, const char* devtype)
 {
@@ -97,398 +337,3688 @@ struct udev_device* GetChild(struct udev* udev, struct udev_device* parent, cons
     return child; // Return the matching child device or NULL
 }
 
-char* FindMountPoint(const char* dev_node)
+// Mount table index, parsed from /proc/self/mountinfo and looked up by device number or by mount source
+
+#define MOUNT_INDEX_BUCKETS 1024
+
+typedef struct MountEntry
 {
-    if (dev_node == NULL)
-    {
-        return NULL; // Validate input argument
-    }
+    int mountId;
+    int order;                      // Position in mountinfo, the first mount of a device wins like in /proc/mounts
+    dev_t devnum;
+    char* root;
+    char* mountPoint;
+    char* source;
+    unsigned int generation;
+    struct MountEntry* nextById;
+    struct MountEntry* nextByDevnum;
+    struct MountEntry* nextBySource;
+} MountEntry;
+
+typedef struct MountIndex
+{
+    MountEntry* byId[MOUNT_INDEX_BUCKETS];
+    MountEntry* byDevnum[MOUNT_INDEX_BUCKETS];
+    MountEntry* bySource[MOUNT_INDEX_BUCKETS];
+    unsigned int generation;
+    int fd;                         // Kept open, the kernel flags it with POLLPRI when the mount table changes
+    int valid;
+} MountIndex;
 
-    FILE* file = setmntent("/proc/mounts", "r");
-    if (file == NULL)
-    {
-        return NULL; // Check if file opening succeeded
-    }
+MountIndex mountIndex = { .fd = -1 };
 
-    struct mntent entry;
-    char buf[4096];
-    struct mntent* mount_table_entry;
-    char* mount_point = NULL;
+pthread_mutex_t mountIndexMutex = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned int HashString(const char* value)
+{
+    // FNV-1a
+    unsigned int hash = 2166136261u;
 
-    while ((mount_table_entry = getmntent_r(file, &entry, buf, sizeof(buf))) != NULL)
+    while (*value)
     {
-        if (mount_table_entry->mnt_fsname && 
-            mount_table_entry->mnt_dir &&
-            strcmp(mount_table_entry->mnt_fsname, dev_node) == 0)
-        {
-            mount_point = strdup(mount_table_entry->mnt_dir); // Return a copy!
-            break;
-        }
+        hash ^= (unsigned char)*value++;
+        hash *= 16777619u;
     }
 
-    endmntent(file);
+    return hash;
+}
 
-    return mount_point; // Caller must free this!
+unsigned int HashDevnum(dev_t devnum)
+{
+    return major(devnum) * 31u + minor(devnum);
 }
 
-void GetDeviceInfo(struct udev_device* dev)
+// Decode the octal escapes (\040, \011, \012, \134) that the kernel uses for whitespace in mountinfo fields
+void UnescapeMountField(char* field)
 {
-    if (dev == NULL)
+    char* out = field;
+
+    while (*field)
     {
-        return; // Validate input argument
+        if (field[0] == '\\' &&
+            field[1] >= '0' && field[1] <= '7' &&
+            field[2] >= '0' && field[2] <= '7' &&
+            field[3] >= '0' && field[3] <= '7')
+        {
+            *out++ = (char)(((field[1] - '0') << 6) | ((field[2] - '0') << 3) | (field[3] - '0'));
+            field += 4;
+        }
+        else
+        {
+            *out++ = *field++;
+        }
     }
 
-    usbDevice = empty;
+    *out = '\0';
+}
+
+void UnlinkMountEntry(MountEntry* entry)
+{
+    MountEntry** link = &mountIndex.byDevnum[HashDevnum(entry->devnum) % MOUNT_INDEX_BUCKETS];
+    while (*link && *link != entry)
+        link = &(*link)->nextByDevnum;
+    if (*link)
+        *link = entry->nextByDevnum;
+
+    link = &mountIndex.bySource[HashString(entry->source) % MOUNT_INDEX_BUCKETS];
+    while (*link && *link != entry)
+        link = &(*link)->nextBySource;
+    if (*link)
+        *link = entry->nextBySource;
+}
 
-    const char* DeviceName = udev_device_get_property_value(dev, "DEVNAME");
-    if (DeviceName)
-        snprintf(usbDevice.DeviceName, sizeof(usbDevice.DeviceName), "%s", DeviceName);
+void LinkMountEntry(MountEntry* entry)
+{
+    unsigned int devnumBucket = HashDevnum(entry->devnum) % MOUNT_INDEX_BUCKETS;
+    entry->nextByDevnum = mountIndex.byDevnum[devnumBucket];
+    mountIndex.byDevnum[devnumBucket] = entry;
 
-    const char* DeviceSystemPath = udev_device_get_syspath(dev); //udev_device_get_property_value(dev, "DEVPATH");
-    if (DeviceSystemPath)
-        snprintf(usbDevice.DeviceSystemPath, sizeof(usbDevice.DeviceSystemPath), "%s", DeviceSystemPath);
+    unsigned int sourceBucket = HashString(entry->source) % MOUNT_INDEX_BUCKETS;
+    entry->nextBySource = mountIndex.bySource[sourceBucket];
+    mountIndex.bySource[sourceBucket] = entry;
+}
 
-    const char* Product = udev_device_get_property_value(dev, "ID_MODEL");
-    if (Product)
-        snprintf(usbDevice.Product, sizeof(usbDevice.Product), "%s", Product);
+void FreeMountEntry(MountEntry* entry)
+{
+    free(entry->root);
+    free(entry->mountPoint);
+    free(entry->source);
+    free(entry);
+}
 
-    const char* ProductDescription = udev_device_get_property_value(dev, "ID_MODEL_FROM_DATABASE");
-    if (ProductDescription)
-        snprintf(usbDevice.ProductDescription, sizeof(usbDevice.ProductDescription), "%s", ProductDescription);
+// Add or update one mountinfo line, mounts that did not change keep their entry and are only marked as seen
+void IndexMountInfoLine(char* line, int order)
+{
+    // 36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw,errors=continue
+    char* fields[5];
+    char* source = NULL;
+    char* save = NULL;
+    int count = 0;
+    int separator = 0;
+
+    for (char* token = strtok_r(line, " ", &save); token; token = strtok_r(NULL, " ", &save))
+    {
+        if (count < 5)
+        {
+            fields[count++] = token;
+        }
+        else if (!separator)
+        {
+            separator = strcmp(token, "-") == 0; // Skip the optional fields
+        }
+        else if (separator++ == 2)
+        {
+            source = token; // The field after the file system type
+            break;
+        }
+    }
 
-    const char* ProductID = udev_device_get_property_value(dev, "ID_MODEL_ID");
-    if (ProductID)
-        snprintf(usbDevice.ProductID, sizeof(usbDevice.ProductID), "%s", ProductID);
+    unsigned int devMajor;
+    unsigned int devMinor;
 
-    const char* SerialNumber = udev_device_get_property_value(dev, "ID_SERIAL_SHORT");
-    if (SerialNumber)
-        snprintf(usbDevice.SerialNumber, sizeof(usbDevice.SerialNumber), "%s", SerialNumber);
+    if (count < 5 || !source || sscanf(fields[2], "%u:%u", &devMajor, &devMinor) != 2)
+    {
+        return; // Malformed line
+    }
 
-    const char* Vendor = udev_device_get_property_value(dev, "ID_VENDOR");
-    if (Vendor)
-        snprintf(usbDevice.Vendor, sizeof(usbDevice.Vendor), "%s", Vendor);
+    int mountId = atoi(fields[0]);
+    dev_t devnum = makedev(devMajor, devMinor);
 
-    const char* VendorDescription = udev_device_get_property_value(dev, "ID_VENDOR_FROM_DATABASE");
-    if (VendorDescription)
-        snprintf(usbDevice.VendorDescription, sizeof(usbDevice.VendorDescription), "%s", VendorDescription);
+    UnescapeMountField(fields[3]);
+    UnescapeMountField(fields[4]);
+    UnescapeMountField(source);
 
-    const char* VendorID = udev_device_get_property_value(dev, "ID_VENDOR_ID");
-    if (VendorID)
-        snprintf(usbDevice.VendorID, sizeof(usbDevice.VendorID), "%s", VendorID);
-}
+    MountEntry* entry = mountIndex.byId[(unsigned int)mountId % MOUNT_INDEX_BUCKETS];
+    while (entry && entry->mountId != mountId)
+        entry = entry->nextById;
 
-void MonitorCallback(struct udev_device* dev)
-{
-    if (dev == NULL)
+    if (entry &&
+        entry->devnum == devnum &&
+        strcmp(entry->root, fields[3]) == 0 &&
+        strcmp(entry->mountPoint, fields[4]) == 0 &&
+        strcmp(entry->source, source) == 0)
     {
-        return; // Validate input argument
+        entry->order = order;
+        entry->generation = mountIndex.generation;
+        return; // Unchanged
     }
 
-    const char* action = udev_device_get_action(dev);
+    char* root = strdup(fields[3]);
+    char* mountPoint = strdup(fields[4]);
+    char* sourceCopy = strdup(source);
 
-    if (action == NULL)
+    if (!root || !mountPoint || !sourceCopy)
     {
+        free(root);
+        free(mountPoint);
+        free(sourceCopy);
         return;
     }
-    
-    // if device already exists "action" is NULL, otherwise it can be "add", "remove", "change", "move", "online", "offline", "bind", "unbind"
 
-    if (action && (strcmp(action, "remove") == 0 || strcmp(action, "unbind") == 0 || strcmp(action, "offline") == 0))
+    if (entry)
     {
-        RemovedCallback(usbDevice);
+        // A mount ID was reused, or the mount was moved
+        UnlinkMountEntry(entry);
+        free(entry->root);
+        free(entry->mountPoint);
+        free(entry->source);
     }
-    else if (action && (strcmp(action, "add") == 0 || strcmp(action, "bind") == 0 || strcmp(action, "online") == 0))
+    else
     {
-        InsertedCallback(usbDevice);
+        entry = calloc(1, sizeof(MountEntry));
+        if (!entry)
+        {
+            free(root);
+            free(mountPoint);
+            free(sourceCopy);
+            return;
+        }
+
+        unsigned int idBucket = (unsigned int)mountId % MOUNT_INDEX_BUCKETS;
+        entry->mountId = mountId;
+        entry->nextById = mountIndex.byId[idBucket];
+        mountIndex.byId[idBucket] = entry;
     }
+
+    entry->order = order;
+    entry->devnum = devnum;
+    entry->root = root;
+    entry->mountPoint = mountPoint;
+    entry->source = sourceCopy;
+    entry->generation = mountIndex.generation;
+
+    LinkMountEntry(entry);
 }
 
-void EnumerateDevices(struct udev* udev, int includeTTY)
+// Drop every entry that was not seen in the last parse
+void PruneMountIndex(void)
 {
-    if (udev == NULL)
+    for (int bucket = 0; bucket < MOUNT_INDEX_BUCKETS; ++bucket)
     {
-        return; // Validate input argument
-    }
+        MountEntry** link = &mountIndex.byId[bucket];
 
-    struct udev_enumerate* enumerate = udev_enumerate_new(udev);
-    if (!enumerate)
-    {
-        return; // Check if enumeration object is created successfully
+        while (*link)
+        {
+            MountEntry* entry = *link;
+
+            if (entry->generation != mountIndex.generation)
+            {
+                *link = entry->nextById;
+                UnlinkMountEntry(entry);
+                FreeMountEntry(entry);
+            }
+            else
+            {
+                link = &entry->nextById;
+            }
+        }
     }
+}
 
-    if (udev_enumerate_add_match_subsystem(enumerate, "usb") < 0)
+// Must be called with mountIndexMutex held
+int UpdateMountIndex(void)
+{
+    if (mountIndex.fd == -1)
     {
-        udev_enumerate_unref(enumerate);
-        return; // Check if enumeration operations succeed
+        mountIndex.fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+        if (mountIndex.fd == -1)
+        {
+            return 0;
+        }
+        mountIndex.valid = 0;
     }
 
-    if (includeTTY)
+    if (mountIndex.valid)
     {
-        if (udev_enumerate_add_match_subsystem(enumerate, "tty") < 0)
+        struct pollfd pfd = { .fd = mountIndex.fd, .events = POLLPRI };
+
+        if (poll(&pfd, 1, 0) <= 0 || !(pfd.revents & (POLLPRI | POLLERR)))
         {
-            udev_enumerate_unref(enumerate);
-            return; // Check if enumeration operations succeed
+            return 1; // The mount table did not change since the last parse
         }
     }
 
-    if (udev_enumerate_scan_devices(enumerate) < 0)
+    size_t capacity = 64 * 1024;
+    size_t length = 0;
+    char* buffer = malloc(capacity);
+    if (!buffer)
     {
-        udev_enumerate_unref(enumerate);
-        return; // Check if enumeration operations succeed
+        return mountIndex.valid;
     }
 
-    struct udev_list_entry* devices = udev_enumerate_get_list_entry(enumerate);
-    if (!devices)
+    if (lseek(mountIndex.fd, 0, SEEK_SET) == -1)
     {
-        udev_enumerate_unref(enumerate);
-        return;
+        free(buffer);
+        return mountIndex.valid;
     }
 
-    struct udev_list_entry* entry;
-
-    udev_list_entry_foreach(entry, devices)
+    for (;;)
     {
-        const char* path = udev_list_entry_get_name(entry);
-        if (!path)
+        if (length + 1 >= capacity)
         {
-            continue; // Skip entries without a valid path
+            char* grown = realloc(buffer, capacity * 2);
+            if (!grown)
+            {
+                free(buffer);
+                return mountIndex.valid;
+            }
+            buffer = grown;
+            capacity *= 2;
         }
 
-        struct udev_device* dev = udev_device_new_from_syspath(udev, path);
-
-        if (dev)
+        ssize_t count = read(mountIndex.fd, buffer + length, capacity - length - 1);
+        if (count < 0)
         {
-            if (udev_device_get_devnode(dev))
-            {
-                GetDeviceInfo(dev);
+            if (errno == EINTR)
+                continue;
 
-                InsertedCallback(usbDevice);
-            }
-
-            udev_device_unref(dev);
+            free(buffer);
+            return mountIndex.valid;
+        }
+        if (count == 0)
+        {
+            break;
         }
+        length += (size_t)count;
     }
 
-    udev_enumerate_unref(enumerate);
-}
+    buffer[length] = '\0';
 
-/* msleep(): Sleep for the requested number of milliseconds. */
-int msleep(long msec)
-{
-    struct timespec ts;
-    int res;
+    mountIndex.generation++;
+
+    int order = 0;
+    char* save = NULL;
 
-    if (msec < 0)
+    for (char* line = strtok_r(buffer, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
     {
-        errno = EINVAL;
-        return -1;
+        IndexMountInfoLine(line, order++);
     }
 
-    ts.tv_sec = msec / 1000;
-    ts.tv_nsec = (msec % 1000) * 1000000;
+    PruneMountIndex();
 
-    do
-    {
-        res = nanosleep(&ts, &ts);
-    } while (res && errno == EINTR);
+    free(buffer);
 
-    return res;
+    mountIndex.valid = 1;
+    return 1;
 }
 
-void MonitorDevices(struct udev* udev, int includeTTY)
+MountEntry* PreferMountEntry(MountEntry* best, MountEntry* entry)
 {
-    if (udev == NULL)
-    {
-        return; // Validate input argument
-    }
+    if (!best)
+        return entry;
 
-    struct udev_monitor* mon = udev_monitor_new_from_netlink(udev, "udev");
+    // A mount of the whole file system is preferred over a bind mount of one of its directories
+    int bestIsRoot = strcmp(best->root, "/") == 0;
+    int entryIsRoot = strcmp(entry->root, "/") == 0;
 
-    if (!mon)
+    if (bestIsRoot != entryIsRoot)
+        return entryIsRoot ? entry : best;
+
+    return entry->order < best->order ? entry : best;
+}
+
+char* FindMountPoint(dev_t devnum, const char* dev_node)
+{
+    char* mount_point = NULL;
+
+    pthread_mutex_lock(&mountIndexMutex);
+
+    if (UpdateMountIndex())
     {
-        return;  // Monitor creation failed
+        MountEntry* best = NULL;
+
+        if (major(devnum) != 0)
+        {
+            for (MountEntry* entry = mountIndex.byDevnum[HashDevnum(devnum) % MOUNT_INDEX_BUCKETS]; entry; entry = entry->nextByDevnum)
+            {
+                if (entry->devnum == devnum)
+                    best = PreferMountEntry(best, entry);
+            }
+        }
+
+        if (!best && dev_node)
+        {
+            for (MountEntry* entry = mountIndex.bySource[HashString(dev_node) % MOUNT_INDEX_BUCKETS]; entry; entry = entry->nextBySource)
+            {
+                if (strcmp(entry->source, dev_node) == 0)
+                    best = PreferMountEntry(best, entry);
+            }
+        }
+
+        if (best)
+        {
+            mount_point = strdup(best->mountPoint); // Return a copy!
+        }
     }
 
-    if (udev_monitor_filter_add_match_subsystem_devtype(mon, "usb", NULL) < 0)
+    pthread_mutex_unlock(&mountIndexMutex);
+
+    return mount_point; // Caller must free this!
+}
+
+char* ResolveMountPoint(struct udev* udev, const char* syspath)
+{
+    if (!udev || !syspath)
     {
-        udev_monitor_unref(mon);
-        return;
+        return NULL; // Validate input arguments
     }
 
-    if (includeTTY)
+    char* mount_point = NULL;
+
+    struct udev_device* dev = udev_device_new_from_syspath(udev, syspath);
+    if (dev)
     {
-        if (udev_monitor_filter_add_match_subsystem_devtype(mon, "tty", NULL) < 0)
+        struct udev_device* scsi = GetChild(udev, dev, "scsi", NULL);
+        if (scsi)
         {
-            udev_monitor_unref(mon);
-            return;
+            struct udev_device* block = GetChild(udev, scsi, "block", "partition");
+            if (!block)
+            {
+                block = GetChild(udev, scsi, "block", "disk");
+            }
+            if (block)
+            {
+                mount_point = FindMountPoint(udev_device_get_devnum(block), udev_device_get_devnode(block));
+
+                udev_device_unref(block);
+            }
+
+            udev_device_unref(scsi);
         }
+
+        udev_device_unref(dev);
     }
 
-    if (udev_monitor_enable_receiving(mon) < 0)
+    return mount_point; // Caller must free this!
+}
+
+// Resolve the mount points of several USB devices with one scan of the block subsystem
+// mountPoints[i] receives a copy of the mount point of syspaths[i], or NULL, and the caller must free them
+int ResolveMountPoints(struct udev* udev, const char** syspaths, int count, char** mountPoints)
+{
+    if (!udev || !syspaths || !mountPoints || count <= 0)
     {
-        udev_monitor_unref(mon); // failed to enable receiving
-        return;
+        return 0; // Validate input arguments
     }
 
-    int fd = udev_monitor_get_fd(mon);
-    if (fd == -1)
+    // 2 = mounted partition, 1 = mounted disk, a partition is preferred like in ResolveMountPoint
+    unsigned char* rank = calloc((size_t)count, sizeof(unsigned char));
+    if (!rank)
     {
-        udev_monitor_unref(mon); // invalid file descriptor
-        return;
+        return 0;
     }
 
-    // Create the pipe
-    if (pipe(pipefd) == -1)
+    for (int i = 0; i < count; ++i)
     {
-        udev_monitor_unref(mon); // Clean up on error
-        return;
+        mountPoints[i] = NULL;
     }
 
-    // Set the read end of the pipe to non-blocking mode
-    int flags = fcntl(pipefd[0], F_GETFL);
-
-    if (fcntl(pipefd[0], F_SETFL, flags | O_NONBLOCK) == -1)
+    struct udev_enumerate* enumerate = udev_enumerate_new(udev);
+    if (!enumerate)
     {
-        close(pipefd[0]);
-        close(pipefd[1]);
-        udev_monitor_unref(mon);  // Clean up on error
-        return;
+        free(rank);
+        return 0; // Check if enumeration object is created successfully
     }
 
-    while (runLinuxWatcher)
+    if (udev_enumerate_add_match_subsystem(enumerate, "block") < 0 ||
+        udev_enumerate_scan_devices(enumerate) < 0)
     {
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        FD_SET(pipefd[0], &fds);
-
-        int maxfd = (fd > pipefd[0]) ? fd : pipefd[0];
+        udev_enumerate_unref(enumerate);
+        free(rank);
+        return 0; // Check if enumeration operations succeed
+    }
 
-        int ret = select(maxfd + 1, &fds, NULL, NULL, NULL);
+    struct udev_list_entry* entry;
 
-        if (ret <= 0)
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate))
+    {
+        const char* path = udev_list_entry_get_name(entry);
+        if (!path)
         {
-            msleep(100);
-            continue;
+            continue; // Skip entries without a valid path
         }
 
-        if (FD_ISSET(fd, &fds))
+        struct udev_device* block = udev_device_new_from_syspath(udev, path);
+        if (!block)
         {
-            struct udev_device* dev = udev_monitor_receive_device(mon);
+            continue; // Skip entries that fail to create a device
+        }
 
-            if (dev)
-            {
-                if (udev_device_get_devnode(dev))
-                {
-                    GetDeviceInfo(dev);
+        // The parent is owned by the child and must not be unreferenced
+        struct udev_device* usb = udev_device_get_parent_with_subsystem_devtype(block, "usb", "usb_device");
+        const char* usbSyspath = usb ? udev_device_get_syspath(usb) : NULL;
+        const char* devtype = udev_device_get_devtype(block);
+        unsigned char blockRank = devtype && strcmp(devtype, "partition") == 0 ? 2 : 1;
 
-                    MonitorCallback(dev);
-                }
+        for (int i = 0; usbSyspath && i < count; ++i)
+        {
+            if (rank[i] >= blockRank || !syspaths[i] || strcmp(syspaths[i], usbSyspath) != 0)
+            {
+                continue;
+            }
 
-                udev_device_unref(dev);
+            char* mount_point = FindMountPoint(udev_device_get_devnum(block), udev_device_get_devnode(block));
+            if (mount_point)
+            {
+                free(mountPoints[i]);
+                mountPoints[i] = mount_point;
+                rank[i] = blockRank;
             }
         }
 
-        if (FD_ISSET(pipefd[0], &fds))
-        {
-            // Read from the pipe to clear the signal
-            char buffer[1];
-            read(pipefd[0], buffer, sizeof(buffer));
-            // Exit the loop after receiving the interruption signal
-            break;
-        }
+        udev_device_unref(block);
     }
 
-    // Close the pipe file descriptors
-    close(pipefd[0]);
-    close(pipefd[1]);
+    udev_enumerate_unref(enumerate);
+
+    int found = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        if (mountPoints[i])
+            ++found;
+    }
 
-    udev_monitor_unref(mon);
+    free(rank);
+    return found;
 }
 
-#ifdef __cplusplus
-extern "C" {
-#endif
+void ClearUsbDeviceRecord(UsbDeviceRecord* record)
+{
+    memset(record, 0, sizeof(UsbDeviceRecord));
+    record->Size = sizeof(UsbDeviceRecord);
+}
 
-    void StartLinuxWatcher(UsbDeviceCallback insertedCallback, UsbDeviceCallback removedCallback, int includeTTY)
+void SetUsbDeviceRecordField(UsbDeviceRecord* record, UsbDeviceField field, const char* value)
+{
+    if (!value || record->Fields[field].Offset != 0)
     {
-        InsertedCallback = insertedCallback;
-        RemovedCallback = removedCallback;
+        return; // Each field is set at most once, so that the record always fits USB_DEVICE_RECORD_MAX_SIZE
+    }
 
-        g_udev = udev_new();
+    size_t length = strnlen(value, (field == UsbDeviceFieldDeviceSystemPath ? 1024 : 512) - 1);
+    char* data = (char*)record + record->Size;
 
-        if (!g_udev)
-        {
-            fprintf(stderr, "udev_new() failed\n");
-            return;
-        }
+    memcpy(data, value, length);
+    data[length] = '\0';
 
-        runLinuxWatcher = 1;
+    record->Fields[field].Offset = (uint16_t)record->Size;
+    record->Fields[field].Length = (uint16_t)length;
+    record->Size += (uint32_t)length + 1;
+}
 
-        EnumerateDevices(g_udev, includeTTY);
-        MonitorDevices(g_udev, includeTTY);
+const char* GetUsbDeviceRecordField(const UsbDeviceRecord* record, UsbDeviceField field)
+{
+    return record->Fields[field].Offset ? (const char*)record + record->Fields[field].Offset : "";
+}
 
-        udev_unref(g_udev);
-    }
+// Event queue, indexes run freely and are masked with capacity - 1, the queue is full when head - tail == capacity
 
-    void StopLinuxWatcher()
-    {
-        runLinuxWatcher = 0;
+void SignalEventFd(int fd)
+{
+    uint64_t value = 1;
+    write(fd, &value, sizeof(value));
+}
+
+void DrainEventFd(int fd)
+{
+    uint64_t value;
+    read(fd, &value, sizeof(value));
+}
+
+int EventQueueInit(EventQueue* queue, int capacity, QueueOverflowPolicy policy)
+{
+    uint32_t size = 1;
 
-        // Write to the pipe to interrupt the select call in the main loop
-        char buffer[1] = { 'x' };
-        write(pipefd[1], buffer, sizeof(buffer));
+    while (size < (uint32_t)capacity)
+    {
+        size <<= 1;
     }
 
-    void GetLinuxMountPoint(const char* syspath, MountPointCallback mountPointCallback)
+    queue->slots = calloc(size, sizeof(WatcherEvent));
+    queue->capacity = size;
+    queue->policy = policy;
+    queue->readfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    queue->spacefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    return queue->slots && queue->readfd != -1 && queue->spacefd != -1 ? 0 : -1;
+}
+
+void EventQueueClose(EventQueue* queue)
+{
+    while (queue->overflow)
     {
-        int found = 0;
+        OverflowEvent* event = queue->overflow;
+        queue->overflow = event->next;
+        free(event);
+    }
 
-        // If the watcher is not running, g_udev might be invalid/freed.
-        // Ideally, create a new udev context for this lookup if g_udev is NULL.
-        struct udev* local_udev = g_udev ? udev_ref(g_udev) : udev_new();
+    if (queue->readfd != -1)
+        close(queue->readfd);
 
-        if (syspath && local_udev)
-        {
-            struct udev_device* dev = udev_device_new_from_syspath(local_udev, syspath);
-            if (dev)
-            {
-                struct udev_device* scsi = GetChild(local_udev, dev, "scsi", NULL);
-                if (scsi)
-                {
-                    struct udev_device* block = GetChild(local_udev, scsi, "block", "partition");
-                    if (!block)
-                    {
-                        block = GetChild(local_udev, scsi, "block", "disk");
-                    }
-                    if (block)
-                    {
-                        const char* block_devnode = udev_device_get_devnode(block);
-                        if (block_devnode)
-                        {
-                            char* mount_point = FindMountPoint(block_devnode);
-                            if (mount_point)
-                            {
-                                found = 1;
-                                mountPointCallback(mount_point);
-                                free(mount_point); // Free the copy from FindMountPoint
-                            }
-                        }
-
-                        udev_device_unref(block);
-                    }
-
-                    udev_device_unref(scsi);
-                }
+    if (queue->spacefd != -1)
+        close(queue->spacefd);
 
-                udev_device_unref(dev);
-            }
-        }
+    free(queue->slots);
+    memset(queue, 0, sizeof(EventQueue));
+
+    queue->readfd = -1;
+    queue->spacefd = -1;
+}
 
-        if (local_udev) udev_unref(local_udev);
+int EventQueueTryPush(EventQueue* queue, const WatcherEvent* event)
+{
+    uint32_t head = queue->head;
+
+    if (head - __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST) >= queue->capacity)
+    {
+        return -1;
+    }
+
+    WatcherEvent* slot = &queue->slots[head & (queue->capacity - 1)];
+    slot->kind = event->kind;
+    slot->size = event->size;
+    slot->receivedUs = event->receivedUs;
+    memcpy(&slot->data, &event->data, event->size);
+
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_SEQ_CST);
+
+    if (__atomic_load_n(&queue->readerWaiting, __ATOMIC_SEQ_CST))
+    {
+        SignalEventFd(queue->readfd);
+    }
+
+    return 0;
+}
+
+// Device events are keyed by their system path, mount point changes by the syspath at the start of their data
+const char* WatcherEventKey(const WatcherEvent* event)
+{
+    return event->kind == WatcherEventMountPointChanged ? (const char*)event->data.bytes : GetUsbDeviceRecordField(&event->data.record, UsbDeviceFieldDeviceSystemPath);
+}
+
+void EventQueueCoalesce(EventQueue* queue, const WatcherEvent* event)
+{
+    int mount = event->kind == WatcherEventMountPointChanged;
+    const char* key = WatcherEventKey(event);
+
+    OverflowEvent** link = &queue->overflow;
+
+    while (*link)
+    {
+        OverflowEvent* pending = *link;
+
+        if ((pending->event.kind == WatcherEventMountPointChanged) == mount && strcmp(WatcherEventKey(&pending->event), key) == 0)
+        {
+            // A device keeps its place in the order but only the newest event is delivered
+            __atomic_add_fetch(&queue->coalesced, 1, __ATOMIC_RELAXED);
+
+            pending->event.kind = event->kind;
+            pending->event.size = event->size;
+            pending->event.receivedUs = event->receivedUs;
+            memcpy(&pending->event.data, &event->data, event->size);
+            return;
+        }
+
+        link = &pending->next;
+    }
+
+    OverflowEvent* pending = malloc(sizeof(OverflowEvent));
+    if (!pending)
+    {
+        __atomic_add_fetch(&queue->dropped, 1, __ATOMIC_RELAXED);
+        return; // The event is lost, it was already counted as an overflow
+    }
+
+    pending->event.kind = event->kind;
+    pending->event.size = event->size;
+    pending->event.receivedUs = event->receivedUs;
+    memcpy(&pending->event.data, &event->data, event->size);
+    pending->next = NULL;
+
+    *link = pending;
+}
+
+// Move held back events of the coalesce policy into the ring while it has room
+void EventQueueFlushOverflow(EventQueue* queue)
+{
+    while (queue->overflow && EventQueueTryPush(queue, &queue->overflow->event) == 0)
+    {
+        OverflowEvent* pending = queue->overflow;
+        queue->overflow = pending->next;
+        free(pending);
+    }
+
+    if (queue->overflow)
+    {
+        // Ask the reader to signal spacefd, then try once more in case it read an event before seeing the flag
+        __atomic_store_n(&queue->producerWaiting, 1, __ATOMIC_SEQ_CST);
+
+        while (queue->overflow && EventQueueTryPush(queue, &queue->overflow->event) == 0)
+        {
+            OverflowEvent* pending = queue->overflow;
+            queue->overflow = pending->next;
+            free(pending);
+        }
+    }
+}
+
+void EventQueuePush(EventQueue* queue, int stopfd, const WatcherEvent* event)
+{
+    if (queue->policy == QueueOverflowCoalesce && queue->overflow)
+    {
+        EventQueueFlushOverflow(queue);
+
+        if (queue->overflow)
+        {
+            // Events must not overtake the ones that are held back
+            __atomic_add_fetch(&queue->overflows, 1, __ATOMIC_RELAXED);
+            EventQueueCoalesce(queue, event);
+            return;
+        }
+    }
+
+    if (EventQueueTryPush(queue, event) == 0)
+    {
+        return;
+    }
+
+    __atomic_add_fetch(&queue->overflows, 1, __ATOMIC_RELAXED);
+
+    switch (queue->policy)
+    {
+        case QueueOverflowDropOldest:
+            do
+            {
+                // Fails only if the reader took the oldest event in the meantime, which also frees a slot
+                uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST);
+
+                if (__atomic_compare_exchange_n(&queue->tail, &tail, tail + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+                {
+                    __atomic_add_fetch(&queue->dropped, 1, __ATOMIC_RELAXED);
+                }
+            }
+            while (EventQueueTryPush(queue, event) == -1);
+            break;
+
+        case QueueOverflowBlock:
+            for (;;)
+            {
+                __atomic_store_n(&queue->producerWaiting, 1, __ATOMIC_SEQ_CST);
+
+                if (EventQueueTryPush(queue, event) == 0)
+                {
+                    break;
+                }
+
+                struct pollfd fds[2] = { { queue->spacefd, POLLIN, 0 }, { stopfd, POLLIN, 0 } };
+
+                if (poll(fds, 2, -1) == -1 && errno != EINTR)
+                {
+                    break;
+                }
+
+                if (fds[1].revents & POLLIN)
+                {
+                    __atomic_add_fetch(&queue->dropped, 1, __ATOMIC_RELAXED);
+                    break; // Stopping, the event is dropped and stopfd is left for the event loop
+                }
+
+                DrainEventFd(queue->spacefd);
+            }
+
+            __atomic_store_n(&queue->producerWaiting, 0, __ATOMIC_SEQ_CST);
+            break;
+
+        case QueueOverflowCoalesce:
+            EventQueueCoalesce(queue, event);
+            EventQueueFlushOverflow(queue);
+            break;
+    }
+}
+
+// Copy the oldest event into buffer, returns its kind or WatcherEventNone if the queue is empty
+int EventQueuePop(EventQueue* queue, void* buffer, uint32_t bufferSize, uint64_t* receivedUs)
+{
+    for (;;)
+    {
+        uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_SEQ_CST);
+
+        if (tail == __atomic_load_n(&queue->head, __ATOMIC_SEQ_CST))
+        {
+            return WatcherEventNone;
+        }
+
+        // A drop-oldest producer may overwrite the slot while it is copied, the CAS below then fails and the copy is discarded
+        const WatcherEvent* slot = &queue->slots[tail & (queue->capacity - 1)];
+        uint32_t kind = slot->kind;
+        uint32_t size = slot->size;
+        *receivedUs = slot->receivedUs;
+
+        if (size > bufferSize)
+        {
+            size = bufferSize;
+        }
+
+        memcpy(buffer, &slot->data, size);
+
+        if (__atomic_compare_exchange_n(&queue->tail, &tail, tail + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+        {
+            if (__atomic_load_n(&queue->producerWaiting, __ATOMIC_SEQ_CST))
+            {
+                SignalEventFd(queue->spacefd);
+            }
+
+            return (int)kind;
+        }
+    }
+}
+
+// Statistics
+
+uint64_t MonotonicUs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000000 + (uint64_t)now.tv_nsec / 1000;
+}
+
+int GetLatencyBucket(uint64_t latencyUs)
+{
+    if (latencyUs < (1u << LATENCY_SUB_BUCKET_BITS))
+    {
+        return (int)latencyUs;
+    }
+
+    int msb = 63 - __builtin_clzll(latencyUs);
+    int bucket = ((msb - LATENCY_SUB_BUCKET_BITS + 1) << LATENCY_SUB_BUCKET_BITS) |
+        (int)((latencyUs >> (msb - LATENCY_SUB_BUCKET_BITS)) & ((1u << LATENCY_SUB_BUCKET_BITS) - 1));
+
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+void RecordLatency(uint64_t* histogram, uint64_t latencyUs)
+{
+    __atomic_add_fetch(&histogram[GetLatencyBucket(latencyUs)], 1, __ATOMIC_RELAXED);
+}
+
+// Count a device event that is passed to the application at now, receivedUs is 0 for enumerated devices
+void RecordDispatch(WatcherStats* stats, uint64_t receivedUs, uint64_t now)
+{
+    __atomic_add_fetch(&stats->EventsDispatched, 1, __ATOMIC_RELAXED);
+
+    if (receivedUs)
+    {
+        RecordLatency(stats->DispatchLatency, now > receivedUs ? now - receivedUs : 0);
+    }
+}
+
+// dev is NULL for a replayed message, whose initialization time belongs to the recording
+void RecordReceivedEvent(WatcherStats* stats, struct udev_device* dev, const char* action)
+{
+    __atomic_add_fetch(&stats->EventsReceived, 1, __ATOMIC_RELAXED);
+
+    uint64_t* counter = &stats->OtherActions;
+
+    if (action && strcmp(action, "add") == 0)
+    {
+        counter = &stats->AddActions;
+
+        // 0 if udev did not record when it initialized the device
+        unsigned long long initializedUs = dev ? udev_device_get_usec_since_initialized(dev) : 0;
+
+        if (initializedUs)
+        {
+            RecordLatency(stats->InitializedLatency, initializedUs);
+        }
+    }
+    else if (action && strcmp(action, "remove") == 0)
+        counter = &stats->RemoveActions;
+    else if (action && strcmp(action, "change") == 0)
+        counter = &stats->ChangeActions;
+    else if (action && strcmp(action, "bind") == 0)
+        counter = &stats->BindActions;
+    else if (action && strcmp(action, "unbind") == 0)
+        counter = &stats->UnbindActions;
+
+    __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+// Batch delivery
+
+void FlushDeviceBatch(WatcherContext* ctx)
+{
+    DeviceBatch* batch = &ctx->batch;
+
+    if (batch->count == 0)
+    {
+        return;
+    }
+
+    uint64_t now = MonotonicUs();
+
+    for (int i = 0; i < batch->count; i++)
+    {
+        batch->events[i].Record = (const UsbDeviceRecord*)(batch->data + batch->offsets[i]);
+        RecordDispatch(&ctx->stats, batch->receivedUs[i], now);
+    }
+
+    ctx->BatchCallback(batch->events, batch->count);
+
+    batch->count = 0;
+    batch->size = 0;
+}
+
+// Copy the record into the batch, returns -1 if it could not grow
+int AddToDeviceBatch(WatcherContext* ctx, WatcherEventKind kind, const UsbDeviceRecord* record)
+{
+    DeviceBatch* batch = &ctx->batch;
+
+    if (batch->count == DEVICE_BATCH_MAX_EVENTS)
+    {
+        FlushDeviceBatch(ctx);
+    }
+
+    // Records are kept 4-byte aligned for their header fields
+    size_t size = (record->Size + 3) & ~(size_t)3;
+
+    if (batch->size + size > batch->capacity)
+    {
+        size_t capacity = batch->capacity ? batch->capacity * 2 : 16384;
+
+        while (capacity < batch->size + size)
+        {
+            capacity *= 2;
+        }
+
+        unsigned char* data = realloc(batch->data, capacity);
+        if (!data)
+        {
+            return -1;
+        }
+
+        batch->data = data;
+        batch->capacity = capacity;
+    }
+
+    memcpy(batch->data + batch->size, record, record->Size);
+
+    batch->offsets[batch->count] = batch->size;
+    batch->receivedUs[batch->count] = ctx->receivedUs;
+    batch->events[batch->count].Kind = kind;
+    batch->count++;
+    batch->size += size;
+
+    return 0;
+}
+
+// Deliver an event to the queue if it is enabled, otherwise to the batch or to the callbacks
+
+void ReportDevice(WatcherContext* ctx, WatcherEventKind kind, const UsbDeviceRecord* record)
+{
+    if (ctx->queue.slots)
+    {
+        WatcherEvent* event = &ctx->queueEvent;
+        event->kind = kind;
+        event->size = record->Size;
+        event->receivedUs = ctx->receivedUs;
+        memcpy(&event->data, record, record->Size);
+
+        EventQueuePush(&ctx->queue, ctx->stopfd, event);
+        return;
+    }
+
+    if (ctx->BatchCallback)
+    {
+        if (AddToDeviceBatch(ctx, kind, record) == -1)
+        {
+            // Out of memory, deliver what was collected and then this event on its own
+            FlushDeviceBatch(ctx);
+
+            RecordDispatch(&ctx->stats, ctx->receivedUs, MonotonicUs());
+
+            UsbDeviceEvent event = { kind, record };
+            ctx->BatchCallback(&event, 1);
+        }
+
+        return;
+    }
+
+    RecordDispatch(&ctx->stats, ctx->receivedUs, MonotonicUs());
+
+    if (kind == WatcherEventInserted)
+        ctx->InsertedCallback(record);
+    else
+        ctx->RemovedCallback(record);
+}
+
+void ReportMountPoint(WatcherContext* ctx, const char* syspath, const char* mountPoint)
+{
+    if (!ctx->queue.slots)
+    {
+        // Device events that came first are delivered first
+        if (ctx->BatchCallback)
+        {
+            FlushDeviceBatch(ctx);
+        }
+
+        ctx->MountChangedCallback(syspath, mountPoint);
+        return;
+    }
+
+    WatcherEvent* event = &ctx->queueEvent;
+    size_t capacity = sizeof(event->data.bytes);
+    size_t syspathLength = strnlen(syspath, 1023);
+    size_t mountPointLength = strnlen(mountPoint, capacity - syspathLength - 2);
+
+    memcpy(event->data.bytes, syspath, syspathLength);
+    event->data.bytes[syspathLength] = '\0';
+    memcpy(event->data.bytes + syspathLength + 1, mountPoint, mountPointLength);
+    event->data.bytes[syspathLength + 1 + mountPointLength] = '\0';
+
+    event->kind = WatcherEventMountPointChanged;
+    event->size = (uint32_t)(syspathLength + mountPointLength + 2);
+    event->receivedUs = 0;
+
+    EventQueuePush(&ctx->queue, ctx->stopfd, event);
+}
+
+TrackedDevice* FindTrackedDevice(WatcherContext* ctx, const char* syspath)
+{
+    if (!syspath)
+    {
+        return NULL; // Validate input argument
+    }
+
+    for (TrackedDevice* device = ctx->trackedDevices; device; device = device->next)
+    {
+        if (strcmp(device->syspath, syspath) == 0)
+        {
+            return device;
+        }
+    }
+
+    return NULL;
+}
+
+void FreeTrackedDevice(TrackedDevice* device)
+{
+    free(device->syspath);
+    free(device->mountPoint);
+    free(device->record);
+    free(device);
+}
+
+void TrackDevice(WatcherContext* ctx, const UsbDeviceRecord* record)
+{
+    const char* syspath = GetUsbDeviceRecordField(record, UsbDeviceFieldDeviceSystemPath);
+
+    if (!syspath[0])
+    {
+        return; // Validate input argument
+    }
+
+    if (FindTrackedDevice(ctx, syspath))
+    {
+        return; // Already tracked
+    }
+
+    TrackedDevice* device = calloc(1, sizeof(TrackedDevice));
+    if (!device)
+    {
+        return;
+    }
+
+    device->syspath = strdup(syspath);
+    device->record = malloc(record->Size);
+
+    if (!device->syspath || !device->record)
+    {
+        FreeTrackedDevice(device);
+        return;
+    }
+
+    memcpy(device->record, record, record->Size);
+    device->seen = 1;
+
+    device->next = ctx->trackedDevices;
+    ctx->trackedDevices = device;
+}
+
+void UntrackDevice(WatcherContext* ctx, const char* syspath)
+{
+    if (!syspath)
+    {
+        return; // Validate input argument
+    }
+
+    TrackedDevice** link = &ctx->trackedDevices;
+
+    while (*link)
+    {
+        TrackedDevice* device = *link;
+
+        if (strcmp(device->syspath, syspath) == 0)
+        {
+            *link = device->next;
+            FreeTrackedDevice(device);
+            return;
+        }
+
+        link = &device->next;
+    }
+}
+
+void UntrackAllDevices(WatcherContext* ctx)
+{
+    while (ctx->trackedDevices)
+    {
+        TrackedDevice* device = ctx->trackedDevices;
+        ctx->trackedDevices = device->next;
+        FreeTrackedDevice(device);
+    }
+}
+
+// Resolve the mount point of every tracked device and report only the ones that changed
+void RefreshMountPoints(WatcherContext* ctx)
+{
+    if (!ctx || !ctx->MountChangedCallback)
+    {
+        return; // Validate input arguments
+    }
+
+    // The replayed devices are not the ones of the host, their mount points would differ between runs
+    if (ctx->replay.file)
+    {
+        return;
+    }
+
+    int count = 0;
+
+    for (TrackedDevice* device = ctx->trackedDevices; device; device = device->next)
+    {
+        ++count;
+    }
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    const char** syspaths = calloc((size_t)count, sizeof(const char*));
+    char** mountPoints = calloc((size_t)count, sizeof(char*));
+
+    if (syspaths && mountPoints)
+    {
+        int i = 0;
+
+        for (TrackedDevice* device = ctx->trackedDevices; device; device = device->next)
+        {
+            syspaths[i++] = device->syspath;
+        }
+
+        ResolveMountPoints(ctx->udev, syspaths, count, mountPoints);
+
+        i = 0;
+
+        for (TrackedDevice* device = ctx->trackedDevices; device; device = device->next, ++i)
+        {
+            const char* previous = device->mountPoint ? device->mountPoint : "";
+            const char* current = mountPoints[i] ? mountPoints[i] : "";
+
+            if (strcmp(previous, current) != 0)
+            {
+                free(device->mountPoint);
+                device->mountPoint = mountPoints[i];
+                mountPoints[i] = NULL;
+
+                ReportMountPoint(ctx, device->syspath, current);
+            }
+
+            free(mountPoints[i]);
+        }
+    }
+
+    free(syspaths);
+    free(mountPoints);
+}
+
+// Parse a hexadecimal ID such as "1d6b", returns -1 if the value is missing or invalid
+int32_t ParseDeviceId(const char* value, const char** end)
+{
+    if (!value)
+    {
+        return -1; // Validate input argument
+    }
+
+    char* stop;
+    unsigned long id = strtoul(value, &stop, 16);
+
+    if (stop == value || id > 0xFFFF)
+    {
+        return -1;
+    }
+
+    if (end)
+    {
+        *end = stop;
+    }
+
+    return (int32_t)id;
+}
+
+// Property lookup of a udev device or of a replayed record, so that both are read the same way, returns NULL if key is not set
+typedef const char* (*PropertyGetter)(void* source, const char* key);
+
+const char* GetUdevProperty(void* source, const char* key)
+{
+    return udev_device_get_property_value(source, key);
+}
+
+// Read the vendor and product ID from the event properties, these are also present in remove events when sysfs is already gone
+int GetDeviceIdFromProperties(PropertyGetter getProperty, void* source, uint16_t* vendorId, uint16_t* productId)
+{
+    int32_t vendor = ParseDeviceId(getProperty(source, "ID_VENDOR_ID"), NULL);
+    int32_t product = ParseDeviceId(getProperty(source, "ID_MODEL_ID"), NULL);
+
+    if (vendor < 0 || product < 0)
+    {
+        // The kernel sets PRODUCT=vendor/product/bcdDevice on usb_device and usb_interface
+        const char* next = NULL;
+
+        vendor = ParseDeviceId(getProperty(source, "PRODUCT"), &next);
+        product = vendor >= 0 && *next == '/' ? ParseDeviceId(next + 1, NULL) : -1;
+    }
+
+    if (vendor < 0 || product < 0)
+    {
+        return -1;
+    }
+
+    *vendorId = (uint16_t)vendor;
+    *productId = (uint16_t)product;
+
+    return 0;
+}
+
+int GetDeviceId(struct udev_device* dev, uint16_t* vendorId, uint16_t* productId)
+{
+    if (GetDeviceIdFromProperties(GetUdevProperty, dev, vendorId, productId) == 0)
+    {
+        return 0;
+    }
+
+    // TTY devices without udev IDs inherit them from their USB device
+    struct udev_device* parent = udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
+
+    return parent ? GetDeviceIdFromProperties(GetUdevProperty, parent, vendorId, productId) : -1;
+}
+
+// Description cache: the hardware database descriptions of a vendor/product ID, shared by all watchers and threads,
+// so that repeated plugs of the same model neither look them up nor copy them again
+// Bounded to DESCRIPTION_CACHE_SIZE IDs, when it is full the least recently used one is replaced
+
+#define DESCRIPTION_CACHE_SIZE 256
+
+typedef struct DescriptionEntry
+{
+    uint32_t key;           // Vendor ID << 16 | product ID
+    uint64_t lastUsed;
+    char* vendor;           // Both strings in one allocation, NULL if the entry is free
+    const char* model;
+} DescriptionEntry;
+
+typedef struct DescriptionCache
+{
+    DescriptionEntry entries[DESCRIPTION_CACHE_SIZE];
+    uint64_t clock;
+    uint64_t hits;          // Updated with __atomic builtins, so that they can be read without the mutex
+    uint64_t misses;
+} DescriptionCache;
+
+DescriptionCache descriptionCache;
+
+pthread_mutex_t descriptionCacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Must be called with descriptionCacheMutex held, returns NULL if the strings could not be copied
+DescriptionEntry* AddDescriptionEntry(uint32_t key, const char* vendor, const char* model)
+{
+    DescriptionEntry* entry = &descriptionCache.entries[0];
+
+    for (int i = 0; i < DESCRIPTION_CACHE_SIZE && entry->vendor; i++)
+    {
+        DescriptionEntry* candidate = &descriptionCache.entries[i];
+
+        if (!candidate->vendor || candidate->lastUsed < entry->lastUsed)
+        {
+            entry = candidate;
+        }
+    }
+
+    size_t vendorSize = strlen(vendor) + 1;
+    char* strings = malloc(vendorSize + strlen(model) + 1);
+    if (!strings)
+    {
+        return NULL;
+    }
+
+    memcpy(strings, vendor, vendorSize);
+    strcpy(strings + vendorSize, model);
+
+    free(entry->vendor);
+
+    entry->key = key;
+    entry->vendor = strings;
+    entry->model = strings + vendorSize;
+
+    return entry;
+}
+
+// Set the description fields of the record, from the cache, or from the hwdb properties of source on a miss
+// Devices without a valid ID are not cached
+void SetDeviceDescriptions(PropertyGetter getProperty, void* source, int32_t vendorId, int32_t productId, uint32_t fieldMask, UsbDeviceRecord* usbDevice)
+{
+    const uint32_t descriptionMask = USB_DEVICE_FIELD_BIT(UsbDeviceFieldProductDescription) | USB_DEVICE_FIELD_BIT(UsbDeviceFieldVendorDescription);
+
+    if (!(fieldMask & descriptionMask))
+    {
+        return;
+    }
+
+    DescriptionEntry* entry = NULL;
+
+    if (vendorId >= 0 && productId >= 0)
+    {
+        uint32_t key = (uint32_t)vendorId << 16 | (uint32_t)productId;
+
+        pthread_mutex_lock(&descriptionCacheMutex);
+
+        for (int i = 0; i < DESCRIPTION_CACHE_SIZE && !entry; i++)
+        {
+            if (descriptionCache.entries[i].vendor && descriptionCache.entries[i].key == key)
+            {
+                entry = &descriptionCache.entries[i];
+            }
+        }
+
+        if (entry)
+        {
+            __atomic_add_fetch(&descriptionCache.hits, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            __atomic_add_fetch(&descriptionCache.misses, 1, __ATOMIC_RELAXED);
+
+            const char* vendor = getProperty(source, "ID_VENDOR_FROM_DATABASE");
+            const char* model = getProperty(source, "ID_MODEL_FROM_DATABASE");
+
+            // Only descriptions that udev found are cached, a device without them, such as a TTY without the hwdb import,
+            // must not hide them from the other devices with the same ID
+            if ((vendor && vendor[0]) || (model && model[0]))
+            {
+                entry = AddDescriptionEntry(key, vendor ? vendor : "", model ? model : "");
+            }
+        }
+
+        if (entry)
+        {
+            entry->lastUsed = ++descriptionCache.clock;
+
+            // Copied while the mutex is held, another thread may replace the entry afterwards
+            if (fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldProductDescription))
+            {
+                SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldProductDescription, entry->model);
+            }
+
+            if (fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldVendorDescription))
+            {
+                SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldVendorDescription, entry->vendor);
+            }
+        }
+
+        pthread_mutex_unlock(&descriptionCacheMutex);
+    }
+
+    if (!entry)
+    {
+        if (fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldProductDescription))
+        {
+            SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldProductDescription, getProperty(source, "ID_MODEL_FROM_DATABASE"));
+        }
+
+        if (fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldVendorDescription))
+        {
+            SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldVendorDescription, getProperty(source, "ID_VENDOR_FROM_DATABASE"));
+        }
+    }
+}
+
+// Fill the record with the fields in fieldMask from the properties of source, the system path is passed separately
+void GetDeviceRecordFromProperties(PropertyGetter getProperty, void* source, const char* syspath, uint32_t fieldMask, UsbDeviceRecord* usbDevice)
+{
+    // udev property of each field, the system path is read from the device itself and the descriptions through the cache
+    static const char* const properties[UsbDeviceFieldCount] =
+    {
+        [UsbDeviceFieldDeviceName] = "DEVNAME",
+        [UsbDeviceFieldDeviceSystemPath] = NULL,
+        [UsbDeviceFieldProduct] = "ID_MODEL",
+        [UsbDeviceFieldProductDescription] = NULL,
+        [UsbDeviceFieldProductID] = "ID_MODEL_ID",
+        [UsbDeviceFieldSerialNumber] = "ID_SERIAL_SHORT",
+        [UsbDeviceFieldVendor] = "ID_VENDOR",
+        [UsbDeviceFieldVendorDescription] = NULL,
+        [UsbDeviceFieldVendorID] = "ID_VENDOR_ID"
+    };
+
+    ClearUsbDeviceRecord(usbDevice);
+
+    // Only the fields in the mask are looked up, the others stay unset and read as ""
+    for (int field = 0; field < UsbDeviceFieldCount; field++)
+    {
+        if (!(fieldMask & USB_DEVICE_FIELD_BIT(field)) || field == UsbDeviceFieldProductDescription || field == UsbDeviceFieldVendorDescription)
+        {
+            continue;
+        }
+
+        const char* value = field == UsbDeviceFieldDeviceSystemPath ? syspath : getProperty(source, properties[field]);
+
+        SetUsbDeviceRecordField(usbDevice, (UsbDeviceField)field, value);
+    }
+
+    uint16_t vendorId, productId;
+
+    if (GetDeviceIdFromProperties(getProperty, source, &vendorId, &productId) == 0)
+    {
+        SetDeviceDescriptions(getProperty, source, vendorId, productId, fieldMask, usbDevice);
+    }
+    else
+    {
+        SetDeviceDescriptions(getProperty, source, -1, -1, fieldMask, usbDevice);
+    }
+}
+
+void GetDeviceRecord(struct udev_device* dev, uint32_t fieldMask, UsbDeviceRecord* usbDevice)
+{
+    GetDeviceRecordFromProperties(GetUdevProperty, dev, udev_device_get_syspath(dev), fieldMask, usbDevice);
+}
+
+// Sysfs fast path: the descriptor fields are read from the attribute files of the usb_device, with openat relative
+// to a cached /sys directory fd and into stack buffers, instead of through the udev device and its properties
+
+// Read an attribute of the directory dirfd without the trailing newline, returns its length or -1 if it does not exist
+int ReadSysfsAttribute(int dirfd, const char* attribute, char* buffer, size_t size)
+{
+    int fd = openat(dirfd, attribute, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    ssize_t length = read(fd, buffer, size - 1);
+
+    close(fd);
+
+    if (length < 0)
+    {
+        return -1;
+    }
+
+    while (length > 0 && buffer[length - 1] == '\n')
+    {
+        length--;
+    }
+
+    buffer[length] = '\0';
+
+    return (int)length;
+}
+
+// Encode a descriptor string like udev does for ID_VENDOR, ID_MODEL and ID_SERIAL_SHORT: surrounding whitespace is removed,
+// every run of whitespace inside becomes one '_', and so does every ASCII character other than alphanumerics and "#+-.:=@_"
+void EncodeSysfsValue(char* value)
+{
+    char* from = value;
+    char* to = value;
+
+    while (*from == ' ' || (*from >= '\t' && *from <= '\r'))
+    {
+        from++;
+    }
+
+    while (*from)
+    {
+        unsigned char c = (unsigned char)*from++;
+
+        if (c == ' ' || (c >= '\t' && c <= '\r'))
+        {
+            while (*from == ' ' || (*from >= '\t' && *from <= '\r'))
+            {
+                from++;
+            }
+
+            if (*from)
+            {
+                *to++ = '_'; // Trailing whitespace is dropped
+            }
+        }
+        else
+        {
+            *to++ = c >= 0x80 || (c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || strchr("#+-.:=@_", c) ? (char)c : '_';
+        }
+    }
+
+    *to = '\0';
+}
+
+// Open the directory of the usb_device of path: the first one upwards that has an idVendor attribute, -1 if there is none
+// path is relative to /sys and is shortened while searching
+int OpenSysfsUsbDevice(int sysfsfd, char* path)
+{
+    while (1)
+    {
+        int fd = openat(sysfsfd, path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+        if (fd == -1)
+        {
+            return -1;
+        }
+
+        if (faccessat(fd, "idVendor", F_OK, 0) == 0)
+        {
+            return fd;
+        }
+
+        close(fd);
+
+        char* slash = strrchr(path, '/');
+        if (!slash)
+        {
+            return -1;
+        }
+
+        *slash = '\0';
+    }
+}
+
+// Returns -1 if the device is gone from sysfs (such as in a remove event) or is not part of a USB device,
+// the udev properties have to be used then
+int GetDeviceRecordFromSysfs(int sysfsfd, struct udev_device* dev, uint32_t fieldMask, UsbDeviceRecord* usbDevice)
+{
+    const char* syspath = udev_device_get_syspath(dev);
+
+    // USB devices are below the usbN directory of their root hub, other devices are left to udev without searching upwards
+    if (!syspath || strncmp(syspath, "/sys/", 5) != 0 || !strstr(syspath, "/usb"))
+    {
+        return -1;
+    }
+
+    char path[1024];
+
+    if (snprintf(path, sizeof(path), "%s", syspath + 5) >= (int)sizeof(path))
+    {
+        return -1;
+    }
+
+    int devfd = openat(sysfsfd, path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (devfd == -1)
+    {
+        return -1;
+    }
+
+    int usbfd = OpenSysfsUsbDevice(sysfsfd, path);
+    if (usbfd == -1)
+    {
+        close(devfd);
+        return -1;
+    }
+
+    char value[512];
+    char id[8];
+
+    ClearUsbDeviceRecord(usbDevice);
+
+    if (fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldDeviceName))
+    {
+        // DEVNAME in the uevent attribute is relative to /dev
+        char uevent[4096];
+
+        if (ReadSysfsAttribute(devfd, "uevent", uevent, sizeof(uevent)) != -1)
+        {
+            char* devname = strncmp(uevent, "DEVNAME=", 8) == 0 ? uevent : strstr(uevent, "\nDEVNAME=");
+
+            if (devname)
+            {
+                devname += devname == uevent ? 8 : 9;
+                devname[strcspn(devname, "\n")] = '\0';
+
+                snprintf(value, sizeof(value), "/dev/%s", devname);
+                SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldDeviceName, value);
+            }
+        }
+    }
+
+    if (fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldDeviceSystemPath))
+    {
+        SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldDeviceSystemPath, syspath);
+    }
+
+    // The IDs are read once, for their fields and for the description lookup
+    const uint32_t descriptionMask = USB_DEVICE_FIELD_BIT(UsbDeviceFieldProductDescription) | USB_DEVICE_FIELD_BIT(UsbDeviceFieldVendorDescription);
+    int32_t vendorId = -1;
+    int32_t productId = -1;
+
+    // Vendor and product fall back to their IDs like in udev
+    value[0] = '\0';
+    id[0] = '\0';
+
+    if (fieldMask & (USB_DEVICE_FIELD_BIT(UsbDeviceFieldVendorID) | USB_DEVICE_FIELD_BIT(UsbDeviceFieldVendor) | descriptionMask))
+    {
+        if (ReadSysfsAttribute(usbfd, "idVendor", id, sizeof(id)) != -1)
+        {
+            vendorId = ParseDeviceId(id, NULL);
+
+            if (fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldVendorID))
+            {
+                SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldVendorID, id);
+            }
+        }
+
+        if (fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldVendor))
+        {
+            if (ReadSysfsAttribute(usbfd, "manufacturer", value, sizeof(value)) != -1)
+            {
+                EncodeSysfsValue(value);
+            }
+
+            SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldVendor, value[0] ? value : id);
+        }
+    }
+
+    value[0] = '\0';
+    id[0] = '\0';
+
+    if (fieldMask & (USB_DEVICE_FIELD_BIT(UsbDeviceFieldProductID) | USB_DEVICE_FIELD_BIT(UsbDeviceFieldProduct) | descriptionMask))
+    {
+        if (ReadSysfsAttribute(usbfd, "idProduct", id, sizeof(id)) != -1)
+        {
+            productId = ParseDeviceId(id, NULL);
+
+            if (fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldProductID))
+            {
+                SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldProductID, id);
+            }
+        }
+
+        if (fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldProduct))
+        {
+            if (ReadSysfsAttribute(usbfd, "product", value, sizeof(value)) != -1)
+            {
+                EncodeSysfsValue(value);
+            }
+
+            SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldProduct, value[0] ? value : id);
+        }
+    }
+
+    if ((fieldMask & USB_DEVICE_FIELD_BIT(UsbDeviceFieldSerialNumber)) && ReadSysfsAttribute(usbfd, "serial", value, sizeof(value)) != -1)
+    {
+        EncodeSysfsValue(value);
+        SetUsbDeviceRecordField(usbDevice, UsbDeviceFieldSerialNumber, value);
+    }
+
+    // The descriptions come from the hardware database, which has no sysfs attribute, on a cache hit udev is not involved
+    if (fieldMask & descriptionMask)
+    {
+        SetDeviceDescriptions(GetUdevProperty, dev, vendorId, productId, fieldMask, usbDevice);
+    }
+
+    close(usbfd);
+    close(devfd);
+
+    return 0;
+}
+
+// Fill the record from sysfs if the fast path is enabled (sysfsfd is not -1) and possible, otherwise from the udev properties
+void ReadDeviceRecord(int sysfsfd, struct udev_device* dev, uint32_t fieldMask, UsbDeviceRecord* usbDevice)
+{
+    if (sysfsfd == -1 || GetDeviceRecordFromSysfs(sysfsfd, dev, fieldMask, usbDevice) == -1)
+    {
+        GetDeviceRecord(dev, fieldMask, usbDevice);
+    }
+}
+
+void GetDeviceInfo(WatcherContext* ctx, struct udev_device* dev)
+{
+    if (ctx == NULL || dev == NULL)
+    {
+        return; // Validate input arguments
+    }
+
+    ReadDeviceRecord(ctx->sysfsfd, dev, ctx->fieldMask, &ctx->usbDevice.record);
+}
+
+int MatchesDeviceIdFilter(const DeviceFilter* filter, uint16_t vendorId, uint16_t productId)
+{
+    for (int i = 0; i < filter->idCount; i++)
+    {
+        if (filter->ids[i].vendorId == vendorId && (filter->ids[i].productId == -1 || filter->ids[i].productId == productId))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// Checks the parts of the filter that the kernel socket filter cannot express, or all of it when matchKernelFilter is set
+int MatchesDeviceFilter(const DeviceFilter* filter, struct udev_device* dev, int matchKernelFilter)
+{
+    if (matchKernelFilter)
+    {
+        const char* subsystem = udev_device_get_subsystem(dev);
+        const char* devtype = udev_device_get_devtype(dev);
+
+        if (filter->devtype[0] && subsystem && strcmp(subsystem, "usb") == 0 && (!devtype || strcmp(devtype, filter->devtype) != 0))
+        {
+            return 0;
+        }
+
+        int hasTag = filter->tagCount == 0;
+
+        for (int i = 0; i < filter->tagCount && !hasTag; i++)
+        {
+            hasTag = udev_device_has_tag(dev, filter->tags[i]);
+        }
+
+        if (!hasTag)
+        {
+            return 0;
+        }
+    }
+
+    if (filter->idCount == 0)
+    {
+        return 1;
+    }
+
+    uint16_t vendorId, productId;
+
+    return GetDeviceId(dev, &vendorId, &productId) == 0 && MatchesDeviceIdFilter(filter, vendorId, productId);
+}
+
+int IsRemoveAction(const char* action)
+{
+    return action && (strcmp(action, "remove") == 0 || strcmp(action, "unbind") == 0 || strcmp(action, "offline") == 0);
+}
+
+int IsAddAction(const char* action)
+{
+    return action && (strcmp(action, "add") == 0 || strcmp(action, "bind") == 0 || strcmp(action, "online") == 0);
+}
+
+PendingDevice* FindPendingDevice(WatcherContext* ctx, const char* syspath)
+{
+    for (PendingDevice* pending = ctx->pendingDevices; pending; pending = pending->next)
+    {
+        if (strcmp(pending->syspath, syspath) == 0)
+        {
+            return pending;
+        }
+    }
+
+    return NULL;
+}
+
+// A device is reported if it is tracked, unless a debounced event is pending for it
+int IsDeviceReported(WatcherContext* ctx, const char* syspath)
+{
+    if (!syspath)
+    {
+        return 0; // Validate input argument
+    }
+
+    PendingDevice* pending = FindPendingDevice(ctx, syspath);
+
+    return pending ? pending->added : FindTrackedDevice(ctx, syspath) != NULL;
+}
+
+// The usb_device of an interface or child device, the device itself if it has none
+// Returns NULL for a removed child, the usb_device reports its own removal
+struct udev_device* GetCoalesceTarget(struct udev_device* dev, int removed)
+{
+    const char* subsystem = udev_device_get_subsystem(dev);
+    const char* devtype = udev_device_get_devtype(dev);
+
+    if (subsystem && strcmp(subsystem, "usb") == 0 && devtype && strcmp(devtype, "usb_device") == 0)
+    {
+        return dev;
+    }
+
+    struct udev_device* parent = udev_device_get_parent_with_subsystem_devtype(dev, "usb", "usb_device");
+
+    if (!parent)
+    {
+        return dev;
+    }
+
+    return removed ? NULL : parent;
+}
+
+// Coalescing mode: interfaces and child devices such as TTYs are folded into their usb_device, so that one
+// physical device is reported once, with the properties of the usb_device
+// Returns the device to report, or NULL if the event is dropped, enumerated devices have no action and count as added
+struct udev_device* CoalesceDevice(WatcherContext* ctx, struct udev_device* dev)
+{
+    const char* action = udev_device_get_action(dev);
+    int removed = IsRemoveAction(action);
+
+    if (!removed && action && !IsAddAction(action))
+    {
+        return dev; // Other actions are not reported
+    }
+
+    struct udev_device* target = GetCoalesceTarget(dev, removed);
+
+    if (!target)
+    {
+        return NULL;
+    }
+
+    int reported = IsDeviceReported(ctx, udev_device_get_syspath(target));
+
+    // Report only the first add and a remove of a device that was reported
+    if (removed ? !reported : reported)
+    {
+        return NULL;
+    }
+
+    return target;
+}
+
+// Report the device in ctx->usbDevice with the action of its event
+void MonitorCallback(WatcherContext* ctx, const char* action)
+{
+    if (ctx == NULL)
+    {
+        return; // Validate input argument
+    }
+
+    if (action == NULL)
+    {
+        return;
+    }
+    
+    // if device already exists "action" is NULL, otherwise it can be "add", "remove", "change", "move", "online", "offline", "bind", "unbind"
+
+    if (IsRemoveAction(action))
+    {
+        UntrackDevice(ctx, GetUsbDeviceRecordField(&ctx->usbDevice.record, UsbDeviceFieldDeviceSystemPath));
+
+        ReportDevice(ctx, WatcherEventRemoved, &ctx->usbDevice.record);
+    }
+    else if (IsAddAction(action))
+    {
+        TrackDevice(ctx, &ctx->usbDevice.record);
+
+        ReportDevice(ctx, WatcherEventInserted, &ctx->usbDevice.record);
+    }
+}
+
+// Scan the USB devices, and the TTY devices if includeTTY is set, returns NULL on failure
+struct udev_enumerate* ScanDevices(struct udev* udev, int includeTTY)
+{
+    struct udev_enumerate* enumerate = udev_enumerate_new(udev);
+    if (!enumerate)
+    {
+        return NULL; // Check if enumeration object is created successfully
+    }
+
+    if (udev_enumerate_add_match_subsystem(enumerate, "usb") < 0 ||
+        (includeTTY && udev_enumerate_add_match_subsystem(enumerate, "tty") < 0) ||
+        udev_enumerate_scan_devices(enumerate) < 0)
+    {
+        udev_enumerate_unref(enumerate);
+        return NULL; // Check if enumeration operations succeed
+    }
+
+    return enumerate;
+}
+
+// Snapshot: the current devices as packed records, each 4-byte aligned like in a batch
+
+typedef struct SnapshotSlot
+{
+    unsigned int hash;          // HashString of the syspath
+    size_t offset;              // Offset of the record + 1, 0 if the slot is free
+} SnapshotSlot;
+
+typedef struct DeviceSnapshot
+{
+    unsigned char* data;
+    size_t size;
+    size_t capacity;
+    int count;
+    SnapshotSlot* slots;        // Open addressing index of the records by syspath, for the deduplication of coalesced devices
+    size_t slotCount;           // A power of two, at most half of the slots are used
+} DeviceSnapshot;
+
+// Frees the index, and the records unless they are handed out
+void FreeSnapshot(DeviceSnapshot* snapshot, int freeRecords)
+{
+    if (freeRecords)
+    {
+        free(snapshot->data);
+    }
+
+    free(snapshot->slots);
+}
+
+// slots must have a free slot
+void InsertSnapshotSlot(SnapshotSlot* slots, size_t slotCount, unsigned int hash, size_t offset)
+{
+    size_t i = hash & (slotCount - 1);
+
+    while (slots[i].offset)
+    {
+        i = (i + 1) & (slotCount - 1);
+    }
+
+    slots[i].hash = hash;
+    slots[i].offset = offset + 1;
+}
+
+int HasSnapshotDevice(const DeviceSnapshot* snapshot, const char* syspath)
+{
+    if (!snapshot->slotCount)
+    {
+        return 0;
+    }
+
+    unsigned int hash = HashString(syspath);
+
+    for (size_t i = hash & (snapshot->slotCount - 1); snapshot->slots[i].offset; i = (i + 1) & (snapshot->slotCount - 1))
+    {
+        const UsbDeviceRecord* record = (const UsbDeviceRecord*)(snapshot->data + snapshot->slots[i].offset - 1);
+
+        if (snapshot->slots[i].hash == hash && strcmp(GetUsbDeviceRecordField(record, UsbDeviceFieldDeviceSystemPath), syspath) == 0)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int AddToSnapshot(DeviceSnapshot* snapshot, const UsbDeviceRecord* record)
+{
+    size_t size = (record->Size + 3) & ~(size_t)3;
+
+    if ((size_t)(snapshot->count + 1) * 2 > snapshot->slotCount)
+    {
+        size_t slotCount = snapshot->slotCount ? snapshot->slotCount * 2 : 256;
+
+        SnapshotSlot* slots = calloc(slotCount, sizeof(SnapshotSlot));
+        if (!slots)
+        {
+            return -1;
+        }
+
+        for (size_t i = 0; i < snapshot->slotCount; i++)
+        {
+            if (snapshot->slots[i].offset)
+            {
+                InsertSnapshotSlot(slots, slotCount, snapshot->slots[i].hash, snapshot->slots[i].offset - 1);
+            }
+        }
+
+        free(snapshot->slots);
+        snapshot->slots = slots;
+        snapshot->slotCount = slotCount;
+    }
+
+    if (snapshot->size + size > snapshot->capacity)
+    {
+        size_t capacity = snapshot->capacity ? snapshot->capacity * 2 : 16384;
+
+        while (capacity < snapshot->size + size)
+        {
+            capacity *= 2;
+        }
+
+        unsigned char* data = realloc(snapshot->data, capacity);
+        if (!data)
+        {
+            return -1;
+        }
+
+        snapshot->data = data;
+        snapshot->capacity = capacity;
+    }
+
+    memcpy(snapshot->data + snapshot->size, record, record->Size);
+
+    InsertSnapshotSlot(snapshot->slots, snapshot->slotCount, HashString(GetUsbDeviceRecordField(record, UsbDeviceFieldDeviceSystemPath)), snapshot->size);
+
+    snapshot->size += size;
+    snapshot->count++;
+
+    return 0;
+}
+
+// Add the devices of another snapshot, in coalescing mode without the ones that are already present
+int MergeSnapshot(DeviceSnapshot* snapshot, const DeviceSnapshot* other, int coalesceDevices)
+{
+    size_t offset = 0;
+
+    for (int i = 0; i < other->count; i++)
+    {
+        const UsbDeviceRecord* record = (const UsbDeviceRecord*)(other->data + offset);
+
+        if ((!coalesceDevices || !HasSnapshotDevice(snapshot, GetUsbDeviceRecordField(record, UsbDeviceFieldDeviceSystemPath))) &&
+            AddToSnapshot(snapshot, record) == -1)
+        {
+            return -1;
+        }
+
+        offset += (record->Size + 3) & ~(size_t)3;
+    }
+
+    return 0;
+}
+
+// The syspaths of the scanned devices, they are owned by enumerate, free only the array
+// Returns the number of paths, or -1 if the array could not be allocated
+int GetScannedPaths(struct udev_enumerate* enumerate, const char*** paths)
+{
+    struct udev_list_entry* devices = udev_enumerate_get_list_entry(enumerate);
+    struct udev_list_entry* entry;
+    int count = 0;
+
+    udev_list_entry_foreach(entry, devices)
+    {
+        count++;
+    }
+
+    *paths = malloc((size_t)(count ? count : 1) * sizeof(char*));
+    if (!*paths)
+    {
+        return -1;
+    }
+
+    count = 0;
+
+    udev_list_entry_foreach(entry, devices)
+    {
+        const char* path = udev_list_entry_get_name(entry);
+        if (path)
+        {
+            (*paths)[count++] = path; // Skip entries without a valid path
+        }
+    }
+
+    return count;
+}
+
+// Read the devices at paths that pass the device selection of the context (field mask, filter, coalescing),
+// or all of them with every field if ctx is NULL, returns -1 if the snapshot could not grow
+int CollectDevices(const WatcherContext* ctx, struct udev* udev, const char* const* paths, int count, DeviceSnapshot* snapshot)
+{
+    static const DeviceFilter noFilter;
+
+    const DeviceFilter* filter = ctx ? &ctx->filter : &noFilter;
+    uint32_t fieldMask = ctx ? ctx->fieldMask : USB_DEVICE_FIELD_MASK_ALL;
+    int coalesceDevices = ctx ? ctx->coalesceDevices : 0;
+    int sysfsfd = ctx ? ctx->sysfsfd : -1;
+
+    UsbDeviceRecordBuffer usbDevice;
+    int result = 0;
+
+    for (int i = 0; i < count && result == 0; i++)
+    {
+        struct udev_device* dev = udev_device_new_from_syspath(udev, paths[i]);
+
+        if (dev)
+        {
+            struct udev_device* target = dev;
+
+            // Interfaces of one device coalesce into the same usb_device, which is added once
+            if (udev_device_get_devnode(dev) && MatchesDeviceFilter(filter, dev, 1) &&
+                (!coalesceDevices || ((target = GetCoalesceTarget(dev, 0)) != NULL && !HasSnapshotDevice(snapshot, udev_device_get_syspath(target)))))
+            {
+                ReadDeviceRecord(sysfsfd, target, fieldMask, &usbDevice.record);
+
+                result = AddToSnapshot(snapshot, &usbDevice.record);
+            }
+
+            udev_device_unref(dev);
+        }
+    }
+
+    return result;
+}
+
+// Parallel enumeration: the paths are split into contiguous slices, and every slice is read by its own thread
+// with a udev of its own, because libudev objects must not be shared between threads
+#define ENUMERATION_MAX_THREADS 64
+#define ENUMERATION_MIN_DEVICES_PER_THREAD 16
+
+typedef struct EnumerationWorker
+{
+    const WatcherContext* ctx;
+    const char* const* paths;
+    int count;
+    DeviceSnapshot snapshot;
+    int result;
+} EnumerationWorker;
+
+void* RunEnumerationWorker(void* arg)
+{
+    EnumerationWorker* worker = arg;
+
+    struct udev* udev = udev_new();
+
+    if (!udev)
+    {
+        worker->result = -1;
+        return NULL;
+    }
+
+    worker->result = CollectDevices(worker->ctx, udev, worker->paths, worker->count, &worker->snapshot);
+
+    udev_unref(udev);
+
+    return NULL;
+}
+
+// Like CollectDevices with up to threads threads, the devices are added in the order of the paths
+// The calling thread reads the first slice with udev, which must belong to it
+int CollectDevicesParallel(const WatcherContext* ctx, struct udev* udev, const char* const* paths, int count, int threads, DeviceSnapshot* snapshot)
+{
+    // Threads only pay off for a number of devices each
+    if (threads > count / ENUMERATION_MIN_DEVICES_PER_THREAD)
+    {
+        threads = count / ENUMERATION_MIN_DEVICES_PER_THREAD;
+    }
+
+    if (threads > ENUMERATION_MAX_THREADS)
+    {
+        threads = ENUMERATION_MAX_THREADS;
+    }
+
+    if (threads <= 1)
+    {
+        return CollectDevices(ctx, udev, paths, count, snapshot);
+    }
+
+    EnumerationWorker workers[ENUMERATION_MAX_THREADS];
+    pthread_t handles[ENUMERATION_MAX_THREADS];
+    int started[ENUMERATION_MAX_THREADS] = { 0 };
+
+    for (int i = 0; i < threads; i++)
+    {
+        int begin = (int)((long)count * i / threads);
+        int end = (int)((long)count * (i + 1) / threads);
+
+        workers[i] = (EnumerationWorker){ .ctx = ctx, .paths = paths + begin, .count = end - begin };
+    }
+
+    for (int i = 1; i < threads; i++)
+    {
+        started[i] = pthread_create(&handles[i], NULL, RunEnumerationWorker, &workers[i]) == 0;
+    }
+
+    workers[0].result = CollectDevices(ctx, udev, workers[0].paths, workers[0].count, &workers[0].snapshot);
+
+    int result = 0;
+
+    for (int i = 0; i < threads; i++)
+    {
+        if (i > 0)
+        {
+            if (started[i])
+            {
+                pthread_join(handles[i], NULL);
+            }
+            else
+            {
+                RunEnumerationWorker(&workers[i]); // No thread available, read the slice here
+            }
+        }
+
+        if (result == 0)
+        {
+            result = workers[i].result == 0 ? MergeSnapshot(snapshot, &workers[i].snapshot, ctx && ctx->coalesceDevices) : -1;
+        }
+
+        FreeSnapshot(&workers[i].snapshot, 1);
+    }
+
+    return result;
+}
+
+// Applies the device selection of the context (TTYs, fields, filter, coalescing), or the defaults if ctx is NULL
+// It uses a udev of its own, so that it can run on any thread while the watcher is running
+// Returns the number of devices, or -1 if the devices could not be enumerated
+int SnapshotDevices(const WatcherContext* ctx, DeviceSnapshot* snapshot)
+{
+    struct udev* udev = udev_new();
+    if (!udev)
+    {
+        return -1;
+    }
+
+    struct udev_enumerate* enumerate = ScanDevices(udev, ctx ? ctx->includeTTY : 0);
+    if (!enumerate)
+    {
+        udev_unref(udev);
+        return -1;
+    }
+
+    const char** paths = NULL;
+    int count = GetScannedPaths(enumerate, &paths);
+
+    int result = count == -1 ? -1 : CollectDevicesParallel(ctx, udev, paths, count, ctx ? ctx->enumerationThreads : 1, snapshot);
+
+    free(paths);
+    udev_enumerate_unref(enumerate);
+    udev_unref(udev);
+
+    return result == -1 ? -1 : snapshot->count;
+}
+
+void EnumerateDevices(WatcherContext* ctx)
+{
+    if (ctx == NULL)
+    {
+        return; // Validate input argument
+    }
+
+    struct udev_enumerate* enumerate = ScanDevices(ctx->udev, ctx->includeTTY);
+    if (!enumerate)
+    {
+        return;
+    }
+
+    // The devices are read first, possibly in parallel, then compared with the tracked devices on this thread
+    // An empty list is not an error, a resync then reports every tracked device as removed
+    const char** paths = NULL;
+    int count = GetScannedPaths(enumerate, &paths);
+
+    DeviceSnapshot snapshot = { 0 };
+
+    int result = count == -1 ? -1 : CollectDevicesParallel(ctx, ctx->udev, paths, count, ctx->enumerationThreads, &snapshot);
+
+    free(paths);
+    udev_enumerate_unref(enumerate);
+
+    if (result == -1)
+    {
+        FreeSnapshot(&snapshot, 1);
+        return; // An incomplete list would report present devices as removed
+    }
+
+    for (TrackedDevice* device = ctx->trackedDevices; device; device = device->next)
+    {
+        device->seen = 0;
+    }
+
+    size_t offset = 0;
+
+    for (int i = 0; i < snapshot.count; i++)
+    {
+        const UsbDeviceRecord* record = (const UsbDeviceRecord*)(snapshot.data + offset);
+
+        TrackedDevice* tracked = FindTrackedDevice(ctx, GetUsbDeviceRecordField(record, UsbDeviceFieldDeviceSystemPath));
+
+        if (tracked)
+        {
+            tracked->seen = 1; // Already reported, found again by a resync
+        }
+        else
+        {
+            TrackDevice(ctx, record);
+
+            ReportDevice(ctx, WatcherEventInserted, record);
+        }
+
+        offset += (record->Size + 3) & ~(size_t)3;
+    }
+
+    FreeSnapshot(&snapshot, 1);
+
+    // Devices that were reported but are gone, only possible after events were lost
+    TrackedDevice* device = ctx->trackedDevices;
+
+    while (device)
+    {
+        TrackedDevice* next = device->next;
+
+        if (!device->seen)
+        {
+            ReportDevice(ctx, WatcherEventRemoved, device->record);
+            UntrackDevice(ctx, device->syspath);
+        }
+
+        device = next;
+    }
+
+    FlushDeviceBatch(ctx);
+}
+
+// Event loop: one epoll instance that dispatches every registered file descriptor to its handler
+
+int EventLoopInit(EventLoop* loop)
+{
+    loop->running = 0;
+    loop->epollfd = epoll_create1(EPOLL_CLOEXEC);
+
+    return loop->epollfd == -1 ? -1 : 0;
+}
+
+void EventLoopClose(EventLoop* loop)
+{
+    if (loop->epollfd != -1)
+    {
+        close(loop->epollfd);
+        loop->epollfd = -1;
+    }
+}
+
+int EventLoopAdd(EventLoop* loop, EventSource* source, uint32_t events)
+{
+    if (!loop || !source || source->fd == -1)
+    {
+        return -1; // Validate input arguments
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = source;
+
+    return epoll_ctl(loop->epollfd, EPOLL_CTL_ADD, source->fd, &event);
+}
+
+void EventLoopRemove(EventLoop* loop, EventSource* source)
+{
+    if (loop && source && source->fd != -1)
+    {
+        epoll_ctl(loop->epollfd, EPOLL_CTL_DEL, source->fd, NULL);
+    }
+}
+
+// Creates a disarmed monotonic timerfd for the source and registers it, arm it with EventLoopArmTimer
+int EventLoopAddTimer(EventLoop* loop, EventSource* source)
+{
+    source->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (source->fd == -1)
+    {
+        return -1;
+    }
+
+    if (EventLoopAdd(loop, source, EPOLLIN) == -1)
+    {
+        close(source->fd);
+        source->fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+// Fires the timer once after delayUs microseconds, a delay of 0 disarms it
+int EventLoopArmTimerUs(EventSource* source, uint64_t delayUs)
+{
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = (time_t)(delayUs / 1000000);
+    spec.it_value.tv_nsec = (long)(delayUs % 1000000) * 1000;
+
+    return timerfd_settime(source->fd, 0, &spec, NULL);
+}
+
+// Fires the timer once after delayMs milliseconds, a delay of 0 disarms it
+int EventLoopArmTimer(EventSource* source, long delayMs)
+{
+    return EventLoopArmTimerUs(source, (uint64_t)delayMs * 1000);
+}
+
+// Reads the expiration count so that the timerfd stops being readable
+uint64_t EventLoopAcknowledgeTimer(EventSource* source)
+{
+    uint64_t expirations = 0;
+
+    if (read(source->fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+    {
+        return 0;
+    }
+
+    return expirations;
+}
+
+void EventLoopRun(EventLoop* loop)
+{
+    struct epoll_event events[16];
+
+    while (loop->running)
+    {
+        int count = epoll_wait(loop->epollfd, events, sizeof(events) / sizeof(events[0]), -1);
+
+        if (count == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue; // Interrupted by a signal, wait again right away
+            }
+
+            break;
+        }
+
+        for (int i = 0; i < count && loop->running; ++i)
+        {
+            EventSource* source = events[i].data.ptr;
+
+            source->handler(source, events[i].events);
+        }
+    }
+}
+
+// Debounce: add and remove events of a device are held until no event arrived for debounceMs,
+// then only a change of its net state is reported
+
+uint64_t MonotonicMs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t)now.tv_sec * 1000 + (uint64_t)now.tv_nsec / 1000000;
+}
+
+void FreePendingDevice(PendingDevice* pending)
+{
+    free(pending->syspath);
+    free(pending->record);
+    free(pending);
+}
+
+void FreeAllPendingDevices(WatcherContext* ctx)
+{
+    while (ctx->pendingDevices)
+    {
+        PendingDevice* pending = ctx->pendingDevices;
+        ctx->pendingDevices = pending->next;
+        FreePendingDevice(pending);
+    }
+}
+
+// Report the devices whose window has ended and arm the timer for the next one
+void FlushPendingDevices(WatcherContext* ctx)
+{
+    uint64_t now = MonotonicMs();
+    uint64_t next = 0;
+    int inserted = 0;
+
+    PendingDevice** link = &ctx->pendingDevices;
+
+    while (*link)
+    {
+        PendingDevice* pending = *link;
+
+        if (pending->deadline > now)
+        {
+            if (next == 0 || pending->deadline < next)
+            {
+                next = pending->deadline;
+            }
+
+            link = &pending->next;
+            continue;
+        }
+
+        *link = pending->next;
+
+        unsigned int suppressed = pending->rawEvents;
+        int tracked = FindTrackedDevice(ctx, pending->syspath) != NULL;
+
+        ctx->receivedUs = pending->receivedUs;
+
+        if (pending->added && !tracked)
+        {
+            TrackDevice(ctx, pending->record);
+            ReportDevice(ctx, WatcherEventInserted, pending->record);
+            suppressed--;
+            inserted = 1;
+        }
+        else if (!pending->added && tracked)
+        {
+            UntrackDevice(ctx, pending->syspath);
+            ReportDevice(ctx, WatcherEventRemoved, pending->record);
+            suppressed--;
+        }
+
+        __atomic_add_fetch(&ctx->suppressedEvents, suppressed, __ATOMIC_RELAXED);
+
+        FreePendingDevice(pending);
+    }
+
+    ctx->receivedUs = 0;
+
+    EventLoopArmTimer(ctx->debounceTimer, next ? (long)(next - now) : 0);
+
+    FlushDeviceBatch(ctx);
+
+    // A device may have been mounted while its add was held back
+    if (inserted)
+    {
+        RefreshMountPoints(ctx);
+    }
+}
+
+// Hold the event in ctx->usbDevice, returns -1 if it has to be reported right away
+int DebounceEvent(WatcherContext* ctx, int removed)
+{
+    const UsbDeviceRecord* record = &ctx->usbDevice.record;
+    const char* syspath = GetUsbDeviceRecordField(record, UsbDeviceFieldDeviceSystemPath);
+
+    if (!syspath[0])
+    {
+        return -1;
+    }
+
+    UsbDeviceRecord* copy = malloc(record->Size);
+    if (!copy)
+    {
+        return -1;
+    }
+
+    memcpy(copy, record, record->Size);
+
+    PendingDevice* pending = FindPendingDevice(ctx, syspath);
+
+    if (!pending)
+    {
+        pending = calloc(1, sizeof(PendingDevice));
+        if (!pending || !(pending->syspath = strdup(syspath)))
+        {
+            free(pending);
+            free(copy);
+            return -1;
+        }
+
+        // The other pending devices end earlier, so the timer only has to be armed for the first one
+        if (!ctx->pendingDevices)
+        {
+            EventLoopArmTimer(ctx->debounceTimer, ctx->debounceMs);
+        }
+
+        pending->next = ctx->pendingDevices;
+        ctx->pendingDevices = pending;
+    }
+
+    free(pending->record);
+    pending->record = copy;
+    pending->added = !removed;
+    pending->rawEvents++;
+    pending->deadline = MonotonicMs() + (uint64_t)ctx->debounceMs;
+    pending->receivedUs = ctx->receivedUs;
+
+    return 0;
+}
+
+// Monitor
+
+// Re-enumerate after events were lost: devices that appeared are reported as inserted, and tracked devices that are gone as removed
+void ResyncDevices(WatcherContext* ctx)
+{
+    __atomic_add_fetch(&ctx->resyncs, 1, __ATOMIC_RELAXED);
+
+    // Debounced events are superseded by the current state
+    if (ctx->debounceTimer)
+    {
+        FreeAllPendingDevices(ctx);
+        EventLoopArmTimer(ctx->debounceTimer, 0);
+    }
+
+    EnumerateDevices(ctx);
+
+    RefreshMountPoints(ctx);
+}
+
+// Upper bound of messages read per wakeup, so that a flood cannot delay the stop request
+#define MONITOR_MAX_EVENTS_PER_WAKEUP 1024
+
+int WriteEventLogHeader(WatcherContext* ctx, uint32_t size)
+{
+    unsigned char header[EVENT_LOG_HEADER_SIZE];
+    memcpy(header, &ctx->receivedUs, sizeof(uint64_t));
+    memcpy(header + sizeof(uint64_t), &size, sizeof(uint32_t));
+
+    return fwrite(header, sizeof(header), 1, ctx->recordFile) == 1 ? 0 : -1;
+}
+
+void CloseEventLogOnError(WatcherContext* ctx, int failed)
+{
+    if (failed)
+    {
+        fclose(ctx->recordFile);
+        ctx->recordFile = NULL;
+    }
+}
+
+// Append the properties of a received message to the event log, the recording stops if a write fails
+void WriteEventLogRecord(WatcherContext* ctx, struct udev_device* dev)
+{
+    uint32_t size = 0;
+
+    struct udev_list_entry* entry;
+    udev_list_entry_foreach(entry, udev_device_get_properties_list_entry(dev))
+    {
+        size += (uint32_t)(strlen(udev_list_entry_get_name(entry)) + strlen(udev_list_entry_get_value(entry)) + 2);
+    }
+
+    int failed = WriteEventLogHeader(ctx, size) == -1;
+
+    udev_list_entry_foreach(entry, udev_device_get_properties_list_entry(dev))
+    {
+        failed |= fprintf(ctx->recordFile, "%s=%s", udev_list_entry_get_name(entry), udev_list_entry_get_value(entry)) < 0 ||
+            fputc('\0', ctx->recordFile) == EOF;
+    }
+
+    CloseEventLogOnError(ctx, failed);
+}
+
+// Filter, coalesce, debounce and report a received message
+void HandleReceivedDevice(WatcherContext* ctx, struct udev_device* dev)
+{
+    ctx->receivedUs = MonotonicUs();
+
+    if (ctx->recordFile)
+    {
+        WriteEventLogRecord(ctx, dev);
+    }
+
+    const char* action = udev_device_get_action(dev);
+    int removed = IsRemoveAction(action);
+
+    RecordReceivedEvent(&ctx->stats, dev, action);
+
+    struct udev_device* target = dev;
+
+    // The devtype and tags were already matched by the socket filter, other actions than add and remove are not reported
+    if (!udev_device_get_devnode(dev) || !MatchesDeviceFilter(&ctx->filter, dev, 0) || (!removed && !IsAddAction(action)))
+    {
+        __atomic_add_fetch(&ctx->stats.EventsFiltered, 1, __ATOMIC_RELAXED);
+    }
+    else if (ctx->coalesceDevices && (target = CoalesceDevice(ctx, dev)) == NULL)
+    {
+        __atomic_add_fetch(&ctx->stats.EventsCoalesced, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        // The action is taken from the event, the record from the reported device
+        GetDeviceInfo(ctx, target);
+
+        if (!ctx->debounceTimer || DebounceEvent(ctx, removed) == -1)
+        {
+            MonitorCallback(ctx, action);
+        }
+    }
+
+    ctx->receivedUs = 0;
+}
+
+void OnUdevMonitorEvent(EventSource* source, uint32_t events)
+{
+    WatcherContext* ctx = source->data;
+
+    // Drain the socket until it would block, the events are delivered together at the end
+    for (int i = 0; i < MONITOR_MAX_EVENTS_PER_WAKEUP; i++)
+    {
+        struct udev_device* dev = udev_monitor_receive_device(ctx->monitor);
+
+        if (!dev)
+        {
+            if (errno == ENOBUFS)
+            {
+                // The socket buffer overflowed and the kernel dropped events
+                ResyncDevices(ctx);
+            }
+
+            break;
+        }
+
+        HandleReceivedDevice(ctx, dev);
+
+        udev_device_unref(dev);
+    }
+
+    FlushDeviceBatch(ctx);
+
+    // One write per wakeup, so that the log is complete up to the last wakeup if the process ends without a stop
+    if (ctx->recordFile)
+    {
+        fflush(ctx->recordFile);
+    }
+}
+
+// Replay
+
+// Read the next record of the event log into replay->data and replay->properties, returns 1 on success,
+// 0 at the end of the log and -1 if it is truncated or out of memory
+int ReadEventLogRecord(EventReplay* replay)
+{
+    unsigned char header[EVENT_LOG_HEADER_SIZE];
+    uint32_t size;
+
+    if (fread(header, sizeof(header), 1, replay->file) != 1)
+    {
+        return feof(replay->file) ? 0 : -1;
+    }
+
+    memcpy(&replay->recordUs, header, sizeof(uint64_t));
+    memcpy(&size, header + sizeof(uint64_t), sizeof(uint32_t));
+
+    if (size == 0 || size > (1u << 20))
+    {
+        return -1;
+    }
+
+    if (size > replay->capacity)
+    {
+        char* data = realloc(replay->data, size);
+        if (!data)
+        {
+            return -1;
+        }
+
+        replay->data = data;
+        replay->capacity = size;
+    }
+
+    if (fread(replay->data, size, 1, replay->file) != 1 || replay->data[size - 1] != '\0')
+    {
+        return -1;
+    }
+
+    replay->size = size;
+    replay->propertyCount = 0;
+
+    for (uint32_t offset = 0; offset < size; offset += (uint32_t)strlen(replay->data + offset) + 1)
+    {
+        if (replay->propertyCount == replay->propertyCapacity)
+        {
+            int capacity = replay->propertyCapacity ? replay->propertyCapacity * 2 : 64;
+
+            const char** properties = realloc(replay->properties, capacity * sizeof(const char*));
+            if (!properties)
+            {
+                return -1;
+            }
+
+            replay->properties = properties;
+            replay->propertyCapacity = capacity;
+        }
+
+        replay->properties[replay->propertyCount++] = replay->data + offset;
+    }
+
+    return 1;
+}
+
+// PropertyGetter of the record that was read, source is the EventReplay
+const char* GetReplayProperty(void* source, const char* key)
+{
+    const EventReplay* replay = source;
+    size_t length = strlen(key);
+
+    for (int i = 0; i < replay->propertyCount; i++)
+    {
+        if (strncmp(replay->properties[i], key, length) == 0 && replay->properties[i][length] == '=')
+        {
+            return replay->properties[i] + length + 1;
+        }
+    }
+
+    return NULL;
+}
+
+// TAGS holds the tags of a device as ":tag1:tag2:"
+int HasReplayTag(const char* tags, const char* tag)
+{
+    size_t length = strlen(tag);
+
+    for (const char* found = tags ? strstr(tags, tag) : NULL; found; found = strstr(found + 1, tag))
+    {
+        if (found > tags && found[-1] == ':' && found[length] == ':')
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+// The whole device filter and the subsystems of the monitor on the recorded properties, which did not pass a socket filter
+// Unlike a received TTY, a replayed one without udev IDs cannot inherit them from its USB device
+int MatchesReplayFilter(WatcherContext* ctx, EventReplay* replay)
+{
+    const DeviceFilter* filter = &ctx->filter;
+    const char* subsystem = GetReplayProperty(replay, "SUBSYSTEM");
+
+    if (!subsystem || (strcmp(subsystem, "usb") != 0 && (!ctx->includeTTY || strcmp(subsystem, "tty") != 0)))
+    {
+        return 0;
+    }
+
+    if (filter->devtype[0] && strcmp(subsystem, "usb") == 0)
+    {
+        const char* devtype = GetReplayProperty(replay, "DEVTYPE");
+
+        if (!devtype || strcmp(devtype, filter->devtype) != 0)
+        {
+            return 0;
+        }
+    }
+
+    int hasTag = filter->tagCount == 0;
+
+    for (int i = 0; i < filter->tagCount && !hasTag; i++)
+    {
+        hasTag = HasReplayTag(GetReplayProperty(replay, "TAGS"), filter->tags[i]);
+    }
+
+    if (!hasTag)
+    {
+        return 0;
+    }
+
+    uint16_t vendorId, productId;
+
+    return filter->idCount == 0 ||
+        (GetDeviceIdFromProperties(GetReplayProperty, replay, &vendorId, &productId) == 0 && MatchesDeviceIdFilter(filter, vendorId, productId));
+}
+
+// Coalescing mode for a replayed record, which has no parent device to look up: an interface or child device is folded into
+// the closest reported device above it in syspath, and is reported itself if there is none
+// Returns 0 if the event is reported and -1 if it is dropped, syspath is shortened while searching
+int CoalesceReplayDevice(WatcherContext* ctx, EventReplay* replay, char* syspath, int removed)
+{
+    const char* subsystem = GetReplayProperty(replay, "SUBSYSTEM");
+    const char* devtype = GetReplayProperty(replay, "DEVTYPE");
+
+    int reported = IsDeviceReported(ctx, syspath);
+
+    if (!subsystem || strcmp(subsystem, "usb") != 0 || !devtype || strcmp(devtype, "usb_device") != 0)
+    {
+        for (char* slash = strrchr(syspath, '/'); slash && (size_t)(slash - syspath) > strlen("/sys/devices"); slash = strrchr(syspath, '/'))
+        {
+            *slash = '\0';
+
+            if (IsDeviceReported(ctx, syspath))
+            {
+                return -1;
+            }
+        }
+    }
+
+    // Report only the first add and a remove of a device that was reported
+    return (removed ? !reported : reported) ? -1 : 0;
+}
+
+// Filter, coalesce, debounce and report the record that was read like HandleReceivedDevice does with a received message,
+// but only from the recorded properties: sysfs and the udev database are not read, so that a replay is the same on every host
+void HandleReplayRecord(WatcherContext* ctx)
+{
+    EventReplay* replay = &ctx->replay;
+
+    ctx->receivedUs = MonotonicUs();
+
+    if (ctx->recordFile)
+    {
+        CloseEventLogOnError(ctx, WriteEventLogHeader(ctx, replay->size) == -1 || fwrite(replay->data, replay->size, 1, ctx->recordFile) != 1);
+    }
+
+    const char* action = GetReplayProperty(replay, "ACTION");
+    const char* devpath = GetReplayProperty(replay, "DEVPATH");
+    int removed = IsRemoveAction(action);
+
+    RecordReceivedEvent(&ctx->stats, NULL, action);
+
+    char syspath[1024];
+    char coalescePath[sizeof(syspath)];
+
+    if (!devpath || snprintf(syspath, sizeof(syspath), "/sys%s", devpath) >= (int)sizeof(syspath) || !GetReplayProperty(replay, "DEVNAME") ||
+        !MatchesReplayFilter(ctx, replay) || (!removed && !IsAddAction(action)))
+    {
+        __atomic_add_fetch(&ctx->stats.EventsFiltered, 1, __ATOMIC_RELAXED);
+    }
+    else if (ctx->coalesceDevices && CoalesceReplayDevice(ctx, replay, strcpy(coalescePath, syspath), removed) == -1)
+    {
+        __atomic_add_fetch(&ctx->stats.EventsCoalesced, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+        GetDeviceRecordFromProperties(GetReplayProperty, replay, syspath, ctx->fieldMask, &ctx->usbDevice.record);
+
+        if (!ctx->debounceTimer || DebounceEvent(ctx, removed) == -1)
+        {
+            MonitorCallback(ctx, action);
+        }
+    }
+
+    ctx->receivedUs = 0;
+}
+
+// The event loop ends once the log has been read and the events held back by the debounce window are reported
+void StopIfReplayFinished(WatcherContext* ctx)
+{
+    if (ctx->replay.finished && !ctx->pendingDevices)
+    {
+        ctx->loop.running = 0;
+    }
+}
+
+void OnReplayTimer(EventSource* source, uint32_t events)
+{
+    WatcherContext* ctx = source->data;
+    EventReplay* replay = &ctx->replay;
+
+    EventLoopAcknowledgeTimer(source);
+
+    for (int i = 0; i < MONITOR_MAX_EVENTS_PER_WAKEUP && !replay->finished; i++)
+    {
+        if (!replay->pending)
+        {
+            if (ReadEventLogRecord(replay) != 1)
+            {
+                // A truncated log is replayed up to the damaged record
+                replay->finished = 1;
+                break;
+            }
+
+            if (replay->startUs == 0)
+            {
+                replay->firstUs = replay->recordUs;
+                replay->startUs = MonotonicUs();
+            }
+
+            replay->pending = 1;
+        }
+
+        uint64_t now = MonotonicUs();
+        uint64_t dueUs = replay->startUs + (replay->recordUs > replay->firstUs ? replay->recordUs - replay->firstUs : 0);
+
+        if (!replay->maxSpeed && dueUs > now)
+        {
+            EventLoopArmTimerUs(source, dueUs - now);
+            FlushDeviceBatch(ctx);
+            return;
+        }
+
+        replay->pending = 0;
+
+        HandleReplayRecord(ctx);
+    }
+
+    FlushDeviceBatch(ctx);
+
+    if (replay->finished)
+    {
+        StopIfReplayFinished(ctx);
+    }
+    else
+    {
+        // Let the stop request and the other sources in between
+        EventLoopArmTimerUs(source, 1);
+    }
+}
+
+void OnMountTableChanged(EventSource* source, uint32_t events)
+{
+    // The kernel clears the condition once it has been reported, no read is needed
+    RefreshMountPoints(source->data);
+}
+
+void OnDebounceTimer(EventSource* source, uint32_t events)
+{
+    EventLoopAcknowledgeTimer(source);
+
+    FlushPendingDevices(source->data);
+
+    StopIfReplayFinished(source->data);
+}
+
+void OnEventQueueSpace(EventSource* source, uint32_t events)
+{
+    WatcherContext* ctx = source->data;
+
+    DrainEventFd(ctx->queue.spacefd);
+    __atomic_store_n(&ctx->queue.producerWaiting, 0, __ATOMIC_SEQ_CST);
+
+    EventQueueFlushOverflow(&ctx->queue);
+}
+
+void OnStopRequested(EventSource* source, uint32_t events)
+{
+    WatcherContext* ctx = source->data;
+
+    uint64_t value;
+
+    // Read from the eventfd to clear the signal
+    read(source->fd, &value, sizeof(value));
+
+    ctx->loop.running = 0;
+}
+
+// Create the netlink monitor with the device filter of ctx and enable it, returns NULL on failure
+struct udev_monitor* NewUdevMonitor(WatcherContext* ctx)
+{
+    struct udev_monitor* mon = udev_monitor_new_from_netlink(ctx->udev, "udev");
+
+    if (!mon)
+    {
+        return NULL;  // Monitor creation failed
+    }
+
+    // libudev compiles these matches into a BPF program on the netlink socket, so other events never leave the kernel
+    if (udev_monitor_filter_add_match_subsystem_devtype(mon, "usb", ctx->filter.devtype[0] ? ctx->filter.devtype : NULL) < 0)
+    {
+        udev_monitor_unref(mon);
+        return NULL;
+    }
+
+    for (int i = 0; i < ctx->filter.tagCount; i++)
+    {
+        if (udev_monitor_filter_add_match_tag(mon, ctx->filter.tags[i]) < 0)
+        {
+            udev_monitor_unref(mon);
+            return NULL;
+        }
+    }
+
+    if (ctx->includeTTY)
+    {
+        if (udev_monitor_filter_add_match_subsystem_devtype(mon, "tty", NULL) < 0)
+        {
+            udev_monitor_unref(mon);
+            return NULL;
+        }
+    }
+
+    if (ctx->receiveBufferSize > 0 && udev_monitor_set_receive_buffer_size(mon, ctx->receiveBufferSize) < 0)
+    {
+        // libudev uses SO_RCVBUFFORCE, which needs CAP_NET_ADMIN, without it the size is capped by net.core.rmem_max
+        int size = ctx->receiveBufferSize;
+        setsockopt(udev_monitor_get_fd(mon), SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    if (udev_monitor_enable_receiving(mon) < 0)
+    {
+        udev_monitor_unref(mon); // failed to enable receiving
+        return NULL;
+    }
+
+    return mon;
+}
+
+void MonitorDevices(WatcherContext* ctx)
+{
+    if (ctx == NULL)
+    {
+        return; // Validate input argument
+    }
+
+    struct udev_monitor* mon = NULL;
+
+    // A replay reports only the recorded events, so that it does not depend on the devices of the host
+    if (!ctx->replay.file && (mon = NewUdevMonitor(ctx)) == NULL)
+    {
+        return;
+    }
+
+    ctx->monitor = mon;
+
+    EventSource monitorSource = { mon ? udev_monitor_get_fd(mon) : -1, OnUdevMonitorEvent, ctx };
+    EventSource stopSource = { ctx->stopfd, OnStopRequested, ctx };
+
+    // The kernel flags /proc/self/mountinfo with EPOLLPRI whenever the mount table changes
+    EventSource mountSource = { -1, OnMountTableChanged, ctx };
+
+    if ((mon && EventLoopAdd(&ctx->loop, &monitorSource, EPOLLIN) == -1) ||
+        EventLoopAdd(&ctx->loop, &stopSource, EPOLLIN) == -1)
+    {
+        EventLoopRemove(&ctx->loop, &monitorSource);
+        ctx->monitor = NULL;
+
+        if (mon)
+        {
+            udev_monitor_unref(mon); // Clean up on error
+        }
+
+        return;
+    }
+
+    if (ctx->MountChangedCallback && !ctx->replay.file)
+    {
+        mountSource.fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+
+        if (EventLoopAdd(&ctx->loop, &mountSource, EPOLLPRI) == -1 && mountSource.fd != -1)
+        {
+            close(mountSource.fd);
+            mountSource.fd = -1;
+        }
+    }
+
+    EventSource debounceSource = { -1, OnDebounceTimer, ctx };
+
+    // The coalesce policy moves held back events into the ring when the reader signals free slots
+    EventSource queueSource = { -1, OnEventQueueSpace, ctx };
+
+    if (ctx->queue.slots && ctx->queue.policy == QueueOverflowCoalesce)
+    {
+        queueSource.fd = ctx->queue.spacefd;
+
+        if (EventLoopAdd(&ctx->loop, &queueSource, EPOLLIN) == -1)
+        {
+            queueSource.fd = -1;
+        }
+    }
+
+    if (ctx->debounceMs > 0 && EventLoopAddTimer(&ctx->loop, &debounceSource) == 0)
+    {
+        ctx->debounceTimer = &debounceSource;
+    }
+
+    EventSource replaySource = { -1, OnReplayTimer, ctx };
+
+    if (ctx->replay.file && EventLoopAddTimer(&ctx->loop, &replaySource) == 0)
+    {
+        EventLoopArmTimerUs(&replaySource, 1);
+    }
+
+    RefreshMountPoints(ctx);
+
+    ctx->loop.running = 1;
+
+    EventLoopRun(&ctx->loop);
+
+    EventLoopRemove(&ctx->loop, &queueSource);
+
+    if (replaySource.fd != -1)
+    {
+        EventLoopRemove(&ctx->loop, &replaySource);
+        close(replaySource.fd);
+    }
+
+    // Events still held back are dropped with the watcher
+    if (ctx->debounceTimer)
+    {
+        ctx->debounceTimer = NULL;
+        FreeAllPendingDevices(ctx);
+        EventLoopRemove(&ctx->loop, &debounceSource);
+        close(debounceSource.fd);
+    }
+
+    EventLoopRemove(&ctx->loop, &monitorSource);
+    EventLoopRemove(&ctx->loop, &stopSource);
+
+    if (mountSource.fd != -1)
+    {
+        EventLoopRemove(&ctx->loop, &mountSource);
+        close(mountSource.fd);
+    }
+
+    UntrackAllDevices(ctx);
+
+    ctx->monitor = NULL;
+
+    if (mon)
+    {
+        udev_monitor_unref(mon);
+    }
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+    void ReleaseLinuxWatcherContext(void* ptr)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return;
+
+        EventLoopClose(&ctx->loop);
+        EventQueueClose(&ctx->queue);
+        free(ctx->batch.data);
+
+        if (ctx->stopfd != -1)
+            close(ctx->stopfd);
+
+        if (ctx->sysfsfd != -1)
+            close(ctx->sysfsfd);
+
+        if (ctx->recordFile)
+            fclose(ctx->recordFile);
+
+        if (ctx->replay.file)
+            fclose(ctx->replay.file);
+
+        free(ctx->replay.data);
+        free(ctx->replay.properties);
+
+        if (ctx->udev)
+            udev_unref(ctx->udev);
+
+        free(ctx);
+    }
+
+    void* CreateLinuxWatcherContext(UsbDeviceCallback insertedCallback, UsbDeviceCallback removedCallback, MountPointChangedCallback mountPointChangedCallback, int includeTTY)
+    {
+        WatcherContext* ctx = calloc(1, sizeof(WatcherContext));
+        if (!ctx)
+        {
+            return NULL;
+        }
+
+        ctx->InsertedCallback = insertedCallback;
+        ctx->RemovedCallback = removedCallback;
+        ctx->MountChangedCallback = mountPointChangedCallback;
+        ctx->includeTTY = includeTTY;
+        ctx->fieldMask = USB_DEVICE_FIELD_MASK_ALL;
+        ctx->enumerationThreads = 1;
+        ctx->sysfsfd = -1;
+        ctx->loop.epollfd = -1;
+        ctx->queue.readfd = -1;
+        ctx->queue.spacefd = -1;
+
+        // Created here and not in RunLinuxWatcher, so that StopLinuxWatcher can be called at any time after this returns
+        ctx->stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        ctx->udev = udev_new();
+
+        if (ctx->stopfd == -1 || !ctx->udev || EventLoopInit(&ctx->loop) == -1)
+        {
+            fprintf(stderr, "failed to create the watcher context\n");
+
+            ReleaseLinuxWatcherContext(ctx);
+            return NULL;
+        }
+
+        return ctx;
+    }
+
+    void RunLinuxWatcher(void* ptr)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return;
+
+        // A replay starts from no devices, so that every run reports the same events
+        if (!ctx->replay.file)
+        {
+            EnumerateDevices(ctx);
+        }
+
+        MonitorDevices(ctx);
+
+        // Only now that no more events are pushed, so that the reader still gets the ones queued before the loop returned
+        if (ctx->queue.slots)
+        {
+            EventQueueFlushOverflow(&ctx->queue);
+
+            __atomic_store_n(&ctx->queue.stopped, 1, __ATOMIC_SEQ_CST);
+            SignalEventFd(ctx->queue.readfd);
+        }
+    }
+
+    void SetLinuxWatcherFieldMask(void* ptr, uint32_t fieldMask)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return;
+
+        // Must be called before RunLinuxWatcher, unknown bits are ignored
+        ctx->fieldMask = (fieldMask & USB_DEVICE_FIELD_MASK_ALL) | USB_DEVICE_FIELD_MASK_REQUIRED;
+    }
+
+    // The filter setters must be called before RunLinuxWatcher, they return 0 on success and -1 on error
+
+    int SetLinuxWatcherDevTypeFilter(void* ptr, const char* devtype)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return -1;
+
+        if (!devtype)
+        {
+            ctx->filter.devtype[0] = '\0';
+            return 0;
+        }
+
+        if (strlen(devtype) >= sizeof(ctx->filter.devtype))
+        {
+            return -1;
+        }
+
+        strcpy(ctx->filter.devtype, devtype);
+        return 0;
+    }
+
+    int AddLinuxWatcherTagFilter(void* ptr, const char* tag)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx || !tag || !tag[0]) return -1;
+
+        if (ctx->filter.tagCount == DEVICE_FILTER_MAX_TAGS || strlen(tag) >= sizeof(ctx->filter.tags[0]))
+        {
+            return -1;
+        }
+
+        strcpy(ctx->filter.tags[ctx->filter.tagCount++], tag);
+        return 0;
+    }
+
+    // A productId of -1 matches every product of the vendor
+    int AddLinuxWatcherIdFilter(void* ptr, int vendorId, int productId)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return -1;
+
+        if (ctx->filter.idCount == DEVICE_FILTER_MAX_IDS || vendorId < 0 || vendorId > 0xFFFF || productId < -1 || productId > 0xFFFF)
+        {
+            return -1;
+        }
+
+        DeviceId* id = &ctx->filter.ids[ctx->filter.idCount++];
+        id->vendorId = (uint16_t)vendorId;
+        id->productId = productId;
+        return 0;
+    }
+
+    // Must be called before RunLinuxWatcher
+    void SetLinuxWatcherCoalesceDevices(void* ptr, int coalesceDevices)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return;
+
+        ctx->coalesceDevices = coalesceDevices;
+    }
+
+    // Number of threads that read the devices at startup, at a resync and for a snapshot, 1 reads them on the calling thread
+    void SetLinuxWatcherEnumerationThreads(void* ptr, int threads)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return;
+
+        ctx->enumerationThreads = threads < 1 ? 1 : threads > ENUMERATION_MAX_THREADS ? ENUMERATION_MAX_THREADS : threads;
+    }
+
+    // Must be called before RunLinuxWatcher, reads the descriptor fields of devices that are present in sysfs from their attribute files,
+    // returns -1 if /sys could not be opened
+    int SetLinuxWatcherSysfsFastPath(void* ptr, int enabled)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return -1;
+
+        if (enabled && ctx->sysfsfd == -1)
+        {
+            ctx->sysfsfd = open("/sys", O_PATH | O_DIRECTORY | O_CLOEXEC);
+
+            return ctx->sysfsfd == -1 ? -1 : 0;
+        }
+
+        if (!enabled && ctx->sysfsfd != -1)
+        {
+            close(ctx->sysfsfd);
+            ctx->sysfsfd = -1;
+        }
+
+        return 0;
+    }
+
+    // Lookups of the description cache that is shared by all watchers, and the number of vendor/product IDs in it
+    void GetLinuxDescriptionCacheStats(uint64_t* hits, uint64_t* misses, int* count)
+    {
+        if (hits)
+            *hits = __atomic_load_n(&descriptionCache.hits, __ATOMIC_RELAXED);
+
+        if (misses)
+            *misses = __atomic_load_n(&descriptionCache.misses, __ATOMIC_RELAXED);
+
+        if (count)
+        {
+            pthread_mutex_lock(&descriptionCacheMutex);
+
+            *count = 0;
+
+            for (int i = 0; i < DESCRIPTION_CACHE_SIZE; i++)
+            {
+                *count += descriptionCache.entries[i].vendor != NULL;
+            }
+
+            pthread_mutex_unlock(&descriptionCacheMutex);
+        }
+    }
+
+    // Must be called before RunLinuxWatcher, add/remove events of a device are reported once no event arrived for debounceMs, 0 disables it
+    void SetLinuxWatcherDebounce(void* ptr, int debounceMs)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return;
+
+        ctx->debounceMs = debounceMs > 0 ? debounceMs : 0;
+    }
+
+    // Number of raw add/remove events that were collapsed by the debounce window
+    uint64_t GetLinuxWatcherSuppressedEvents(void* ptr)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return 0;
+
+        return __atomic_load_n(&ctx->suppressedEvents, __ATOMIC_RELAXED);
+    }
+
+    // Must be called before RunLinuxWatcher, events are then queued for ReadLinuxWatcherEvent instead of being passed to the callbacks
+    // capacity is rounded up to a power of two, overflowPolicy is a QueueOverflowPolicy, returns 0 on success and -1 on error
+    int SetLinuxWatcherEventQueue(void* ptr, int capacity, int overflowPolicy)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return -1;
+
+        if (ctx->queue.slots || capacity <= 0 || capacity > (1 << 20) || overflowPolicy < QueueOverflowDropOldest || overflowPolicy > QueueOverflowCoalesce)
+        {
+            return -1;
+        }
+
+        if (EventQueueInit(&ctx->queue, capacity, (QueueOverflowPolicy)overflowPolicy) == -1)
+        {
+            EventQueueClose(&ctx->queue);
+            return -1;
+        }
+
+        return 0;
+    }
+
+    // Called by one reader thread, copies the data of the next event (a UsbDeviceRecord, or the syspath and mount point) into buffer
+    // Returns a WatcherEventKind, 0 on timeout or once RunLinuxWatcher has returned and the queue is empty, -1 on error
+    int ReadLinuxWatcherEvent(void* ptr, void* buffer, int bufferSize, int timeoutMs)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx || !ctx->queue.slots || !buffer || bufferSize <= 0) return -1;
+
+        EventQueue* queue = &ctx->queue;
+
+        for (;;)
+        {
+            uint64_t receivedUs;
+            int kind = EventQueuePop(queue, buffer, (uint32_t)bufferSize, &receivedUs);
+
+            if (kind == WatcherEventNone)
+            {
+                // Set the flag before checking again, so that an event pushed in between also signals readfd
+                __atomic_store_n(&queue->readerWaiting, 1, __ATOMIC_SEQ_CST);
+                kind = EventQueuePop(queue, buffer, (uint32_t)bufferSize, &receivedUs);
+            }
+
+            if (kind != WatcherEventNone)
+            {
+                __atomic_store_n(&queue->readerWaiting, 0, __ATOMIC_SEQ_CST);
+
+                if (kind != WatcherEventMountPointChanged)
+                {
+                    RecordDispatch(&ctx->stats, receivedUs, MonotonicUs());
+                }
+
+                return kind;
+            }
+
+            if (__atomic_load_n(&queue->stopped, __ATOMIC_SEQ_CST))
+            {
+                __atomic_store_n(&queue->readerWaiting, 0, __ATOMIC_SEQ_CST);
+                return 0;
+            }
+
+            struct pollfd fd = { queue->readfd, POLLIN, 0 };
+            int result = poll(&fd, 1, timeoutMs);
+
+            __atomic_store_n(&queue->readerWaiting, 0, __ATOMIC_SEQ_CST);
+
+            if (result == 0)
+            {
+                return 0;
+            }
+
+            if (result == -1 && errno != EINTR)
+            {
+                return -1;
+            }
+
+            DrainEventFd(queue->readfd);
+        }
+    }
+
+    // Number of events that found the queue full
+    uint64_t GetLinuxWatcherQueueOverflows(void* ptr)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return 0;
+
+        return __atomic_load_n(&ctx->queue.overflows, __ATOMIC_RELAXED);
+    }
+
+    // Must be called before RunLinuxWatcher, 0 keeps the default size of the netlink socket buffer
+    void SetLinuxWatcherReceiveBufferSize(void* ptr, int receiveBufferSize)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return;
+
+        ctx->receiveBufferSize = receiveBufferSize > 0 ? receiveBufferSize : 0;
+    }
+
+    // Number of times the devices were re-enumerated because the socket buffer overflowed
+    uint64_t GetLinuxWatcherResyncs(void* ptr)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return 0;
+
+        return __atomic_load_n(&ctx->resyncs, __ATOMIC_RELAXED);
+    }
+
+    // Must be called before RunLinuxWatcher, appends every received udev message to a new event log at path,
+    // returns 0 on success and -1 if the file could not be created
+    int SetLinuxWatcherRecordFile(void* ptr, const char* path)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx || !path || ctx->recordFile) return -1;
+
+        FILE* file = fopen(path, "wb");
+        if (!file)
+        {
+            return -1;
+        }
+
+        if (fwrite(EVENT_LOG_MAGIC, strlen(EVENT_LOG_MAGIC), 1, file) != 1)
+        {
+            fclose(file);
+            return -1;
+        }
+
+        ctx->recordFile = file;
+        return 0;
+    }
+
+    // Must be called before RunLinuxWatcher, feeds the messages of an event log through the same filter, coalesce, debounce
+    // and dispatch steps as received ones, at the recorded pace or as fast as possible if maxSpeed is set
+    // RunLinuxWatcher returns once the log has been replayed, returns 0 on success and -1 if the file is not an event log
+    int SetLinuxWatcherReplayFile(void* ptr, const char* path, int maxSpeed)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx || !path || ctx->replay.file) return -1;
+
+        FILE* file = fopen(path, "rb");
+        if (!file)
+        {
+            return -1;
+        }
+
+        char magic[sizeof(EVENT_LOG_MAGIC)] = { 0 };
+
+        if (fread(magic, strlen(EVENT_LOG_MAGIC), 1, file) != 1 || strcmp(magic, EVENT_LOG_MAGIC) != 0)
+        {
+            fclose(file);
+            return -1;
+        }
+
+        ctx->replay.file = file;
+        ctx->replay.maxSpeed = maxSpeed;
+        return 0;
+    }
+
+    // Copies the counters and latency histograms, they can be read while the watcher runs, each value on its own
+    void GetLinuxWatcherStats(void* ptr, WatcherStats* stats)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx || !stats) return;
+
+        // All members are uint64_t
+        const uint64_t* source = (const uint64_t*)&ctx->stats;
+        uint64_t* target = (uint64_t*)stats;
+
+        for (size_t i = 0; i < sizeof(WatcherStats) / sizeof(uint64_t); i++)
+        {
+            target[i] = __atomic_load_n(&source[i], __ATOMIC_RELAXED);
+        }
+
+        stats->EventsCoalesced += __atomic_load_n(&ctx->queue.coalesced, __ATOMIC_RELAXED);
+        stats->EventsSuppressed = __atomic_load_n(&ctx->suppressedEvents, __ATOMIC_RELAXED);
+        stats->EventsDropped = __atomic_load_n(&ctx->queue.dropped, __ATOMIC_RELAXED);
+        stats->Resyncs = __atomic_load_n(&ctx->resyncs, __ATOMIC_RELAXED);
+    }
+
+    // Must be called before RunLinuxWatcher, device events are then passed to batchCallback instead of the inserted and removed callbacks,
+    // all events read in one wakeup in one call, the records are only valid during the call
+    void SetLinuxWatcherBatchCallback(void* ptr, UsbDeviceBatchCallback batchCallback)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return;
+
+        ctx->BatchCallback = batchCallback;
+    }
+
+    // Enumerates the current devices in one call, with the device selection of the context, which can be NULL
+    // *records receives the packed records (each one starts at a 4-byte aligned offset) and *size their total size,
+    // free them with FreeLinuxDeviceSnapshot, returns the number of devices or -1
+    int SnapshotLinuxDevices(void* ptr, void** records, int* size)
+    {
+        if (!records || !size)
+        {
+            return -1; // Validate input arguments
+        }
+
+        DeviceSnapshot snapshot = { 0 };
+
+        int count = SnapshotDevices(ptr, &snapshot);
+
+        if (count == -1)
+        {
+            FreeSnapshot(&snapshot, 1);
+            return -1;
+        }
+
+        FreeSnapshot(&snapshot, 0);
+
+        *records = snapshot.data;
+        *size = (int)snapshot.size;
+
+        return count;
+    }
+
+    void FreeLinuxDeviceSnapshot(void* records)
+    {
+        free(records);
+    }
+
+    void StopLinuxWatcher(void* ptr)
+    {
+        WatcherContext* ctx = ptr;
+        if (!ctx) return;
+
+        // Write to the eventfd to interrupt the epoll_wait call in the main loop
+        uint64_t value = 1;
+        write(ctx->stopfd, &value, sizeof(value));
+    }
+
+    void GetLinuxMountPoint(const char* syspath, MountPointCallback mountPointCallback)
+    {
+        char* mount_point = NULL;
+
+        struct udev* local_udev = udev_new();
+
+        if (local_udev)
+        {
+            mount_point = ResolveMountPoint(local_udev, syspath);
+
+            udev_unref(local_udev);
+        }
+
+        mountPointCallback(mount_point ? mount_point : "");
+
+        free(mount_point); // Free the copy from ResolveMountPoint
+    }
+
+    int GetLinuxMountPoints(const char** syspaths, int count, char* mountPoints, int mountPointSize)
+    {
+        if (!syspaths || count <= 0 || !mountPoints || mountPointSize <= 0)
+        {
+            return -1; // Validate input arguments
+        }
+
+        memset(mountPoints, 0, (size_t)count * (size_t)mountPointSize);
+
+        char** results = calloc((size_t)count, sizeof(char*));
+        if (!results)
+        {
+            return -1;
+        }
+
+        int found = 0;
+
+        struct udev* local_udev = udev_new();
+
+        if (local_udev)
+        {
+            found = ResolveMountPoints(local_udev, syspaths, count, results);
+
+            udev_unref(local_udev);
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            if (results[i])
+            {
+                snprintf(mountPoints + (size_t)i * (size_t)mountPointSize, (size_t)mountPointSize, "%s", results[i]);
+                free(results[i]);
+            }
+        }
 
-        if (!found)
-            mountPointCallback("");
+        free(results);
+        return found;
     }
 
 #ifdef __cplusplus
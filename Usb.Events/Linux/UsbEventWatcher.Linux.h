@@ -5,32 +5,155 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
+
 // Structures
 
+typedef enum {
+    UsbDeviceFieldDeviceName,
+    UsbDeviceFieldDeviceSystemPath,
+    UsbDeviceFieldProduct,
+    UsbDeviceFieldProductDescription,
+    UsbDeviceFieldProductID,
+    UsbDeviceFieldSerialNumber,
+    UsbDeviceFieldVendor,
+    UsbDeviceFieldVendorDescription,
+    UsbDeviceFieldVendorID,
+    UsbDeviceFieldCount
+} UsbDeviceField;
+
+// Field mask bits for SetLinuxWatcherFieldMask
+#define USB_DEVICE_FIELD_BIT(field) (1u << (field))
+#define USB_DEVICE_FIELD_MASK_ALL ((1u << UsbDeviceFieldCount) - 1)
+
+// The header is directly followed by the NUL-terminated UTF-8 values, Size covers both
 typedef struct {
-    char DeviceName[512];
-    char DeviceSystemPath[1024];
-    char Product[512];
-    char ProductDescription[512];
-    char ProductID[512];
-    char SerialNumber[512];
-    char Vendor[512];
-    char VendorDescription[512];
-    char VendorID[512];
-} UsbDeviceData;
+    uint32_t Size;
+    struct {
+        uint16_t Offset;    // From the start of the record, 0 if the field is not set
+        uint16_t Length;    // Without the terminating NUL
+    } Fields[UsbDeviceFieldCount];
+} UsbDeviceRecord;
+
+static inline const char* UsbDeviceRecordField(const UsbDeviceRecord* record, UsbDeviceField field)
+{
+    return record->Fields[field].Offset ? (const char*)record + record->Fields[field].Offset : "";
+}
+
+typedef enum {
+    WatcherEventNone,
+    WatcherEventInserted,
+    WatcherEventRemoved,
+    WatcherEventMountPointChanged   // The data holds the NUL-terminated syspath followed by the NUL-terminated mount point
+} WatcherEventKind;
+
+typedef enum {
+    QueueOverflowDropOldest,        // The oldest queued event is discarded
+    QueueOverflowBlock,             // The event loop waits until the reader frees a slot
+    QueueOverflowCoalesce           // Events wait outside the queue, the newest one per device and kind replaces older ones
+} QueueOverflowPolicy;
+
+// Log-linear latency buckets in microseconds: values below 4 have a bucket each, every power of two above is split into 4 buckets,
+// the last bucket also counts everything above its range
+#define LATENCY_SUB_BUCKET_BITS 2
+#define LATENCY_BUCKETS 128
+
+typedef struct {
+    uint64_t EventsReceived;        // Messages read from the udev monitor
+    uint64_t EventsFiltered;        // Not reported: no device node, not matching the filter, or an action other than add/remove
+    uint64_t EventsCoalesced;       // Folded into their usb_device, or replaced in the event queue by a newer event
+    uint64_t EventsSuppressed;      // Collapsed by the debounce window
+    uint64_t EventsDropped;         // Discarded by the event queue
+    uint64_t EventsDispatched;      // Device events passed to the application, including enumerated devices
+    uint64_t Resyncs;
+    uint64_t AddActions;            // Received events by action
+    uint64_t RemoveActions;
+    uint64_t ChangeActions;
+    uint64_t BindActions;
+    uint64_t UnbindActions;
+    uint64_t OtherActions;
+    uint64_t InitializedLatency[LATENCY_BUCKETS];   // Add events, from udev initializing the device to receive
+    uint64_t DispatchLatency[LATENCY_BUCKETS];      // Received events, from receive to dispatch
+} WatcherStats;
 
 // Function Pointers
 
-typedef void (*UsbDeviceCallback)(UsbDeviceData usbDevice);
+typedef void (*UsbDeviceCallback)(const UsbDeviceRecord* usbDevice);
 typedef void (*MountPointCallback)(const char* mountPoint);
+typedef void (*MountPointChangedCallback)(const char* syspath, const char* mountPoint);
+
+typedef struct {
+    int32_t Kind;                   // WatcherEventInserted or WatcherEventRemoved
+    const UsbDeviceRecord* Record;
+} UsbDeviceEvent;
+
+typedef void (*UsbDeviceBatchCallback)(const UsbDeviceEvent* events, int count);
 
 // Linux Functions
 
 void GetLinuxMountPoint(const char* syspath, MountPointCallback mountPointCallback);
 
-void StartLinuxWatcher(UsbDeviceCallback insertedCallback, UsbDeviceCallback removedCallback, int includeTTY);
+// Resolves all syspaths with one scan of the block devices, the mount point of syspaths[i] is written
+// to mountPoints + i * mountPointSize ("" if not mounted), returns the number of mounted devices or -1
+int GetLinuxMountPoints(const char** syspaths, int count, char* mountPoints, int mountPointSize);
+
+void* CreateLinuxWatcherContext(UsbDeviceCallback insertedCallback, UsbDeviceCallback removedCallback, MountPointChangedCallback mountPointChangedCallback, int includeTTY);
+// Selects the fields that are fetched for each device, DeviceName and DeviceSystemPath are always included
+void SetLinuxWatcherFieldMask(void* ctx, uint32_t fieldMask);
+
+// Device filter, must be set before RunLinuxWatcher, the setters return 0 on success and -1 on error
+// The devtype only applies to the usb subsystem, a device must have one of the tags and match one of the IDs
+int SetLinuxWatcherDevTypeFilter(void* ctx, const char* devtype);
+int AddLinuxWatcherTagFilter(void* ctx, const char* tag);
+int AddLinuxWatcherIdFilter(void* ctx, int vendorId, int productId); // productId -1 matches all products of the vendor
+
+// Reports interfaces and child devices such as TTYs as their usb_device, once per physical device
+void SetLinuxWatcherCoalesceDevices(void* ctx, int coalesceDevices);
+
+// Reads the devices with up to threads threads, each with its own udev, at startup, at a resync and for a snapshot
+void SetLinuxWatcherEnumerationThreads(void* ctx, int threads);
+
+// Reads the descriptor fields from the sysfs attribute files instead of the udev properties, when the device is still present,
+// returns -1 if /sys could not be opened
+int SetLinuxWatcherSysfsFastPath(void* ctx, int enabled);
+
+// Hits and misses of the hardware database description cache shared by all watchers, and the number of cached vendor/product IDs
+void GetLinuxDescriptionCacheStats(uint64_t* hits, uint64_t* misses, int* count);
+
+// Holds add/remove events of a device until none arrived for debounceMs and reports only the net state change, 0 disables it
+void SetLinuxWatcherDebounce(void* ctx, int debounceMs);
+uint64_t GetLinuxWatcherSuppressedEvents(void* ctx);
+
+// Queues events for one reader thread instead of calling the callbacks, so that a slow consumer does not stall the monitor
+// ReadLinuxWatcherEvent returns a WatcherEventKind, 0 on timeout and once RunLinuxWatcher has returned and the queue is empty, -1 on error
+int SetLinuxWatcherEventQueue(void* ctx, int capacity, int overflowPolicy);
+int ReadLinuxWatcherEvent(void* ctx, void* buffer, int bufferSize, int timeoutMs);
+uint64_t GetLinuxWatcherQueueOverflows(void* ctx);
+
+// Size of the netlink socket buffer, 0 keeps the default, when it overflows the devices are re-enumerated and the differences reported
+void SetLinuxWatcherReceiveBufferSize(void* ctx, int receiveBufferSize);
+uint64_t GetLinuxWatcherResyncs(void* ctx);
+
+// Event log of the received udev messages, for a replay through the same pipeline at the recorded pace or as fast as possible,
+// A replay replaces the enumeration and the monitor of the host devices, RunLinuxWatcher returns once the log has been replayed,
+// both must be set before RunLinuxWatcher and return -1 on error
+int SetLinuxWatcherRecordFile(void* ctx, const char* path);
+int SetLinuxWatcherReplayFile(void* ctx, const char* path, int maxSpeed);
+
+// Counters and CLOCK_MONOTONIC latency histograms of the watcher, they can be read while it runs
+void GetLinuxWatcherStats(void* ctx, WatcherStats* stats);
+
+// Passes all device events of one wakeup to batchCallback in one call, instead of calling the inserted and removed callbacks
+void SetLinuxWatcherBatchCallback(void* ctx, UsbDeviceBatchCallback batchCallback);
+
+// Enumerates the current devices in one call, with the device selection of ctx (or the defaults if it is NULL),
+// *records receives the packed 4-byte aligned records, returns the number of devices or -1
+int SnapshotLinuxDevices(void* ctx, void** records, int* size);
+void FreeLinuxDeviceSnapshot(void* records);
 
-void StopLinuxWatcher(void);
+void RunLinuxWatcher(void* ctx);
+void StopLinuxWatcher(void* ctx);
+void ReleaseLinuxWatcherContext(void* ctx);
 
 #ifdef __cplusplus
 }
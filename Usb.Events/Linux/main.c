@@ -1,43 +1,221 @@
+#define _POSIX_C_SOURCE 199309L
 #include "UsbEventWatcher.Linux.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <pthread.h>
 
-void OnInserted(UsbDeviceData usbDevice)
+void OnInserted(const UsbDeviceRecord* usbDevice)
 {
-    printf("Inserted: %s %s \n", usbDevice.DeviceName, usbDevice.DeviceSystemPath);
+    printf("Inserted: %s %s \n", UsbDeviceRecordField(usbDevice, UsbDeviceFieldDeviceName), UsbDeviceRecordField(usbDevice, UsbDeviceFieldDeviceSystemPath));
 }
 
-void OnRemoved(UsbDeviceData usbDevice)
+void OnRemoved(const UsbDeviceRecord* usbDevice)
 {
-    printf("Removed: %s %s \n", usbDevice.DeviceName, usbDevice.DeviceSystemPath);
+    printf("Removed: %s %s \n", UsbDeviceRecordField(usbDevice, UsbDeviceFieldDeviceName), UsbDeviceRecordField(usbDevice, UsbDeviceFieldDeviceSystemPath));
+}
+
+void OnMountPointChanged(const char* syspath, const char* mountPoint)
+{
+    printf("Mount point: %s %s \n", syspath, mountPoint);
 }
 
 void *StartWatcher(void *arg)
 {
-    StartLinuxWatcher(OnInserted, OnRemoved, 0);
+    RunLinuxWatcher(arg);
 
     pthread_exit(NULL);
 }
 
-int main(void)
+// Average time of a snapshot of the USB and TTY devices, read through libudev or through the sysfs fast path
+double MeasureSnapshot(void* ctx, int iterations, int* count)
+{
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < iterations; i++)
+    {
+        void* records;
+        int size;
+
+        *count = SnapshotLinuxDevices(ctx, &records, &size);
+
+        FreeLinuxDeviceSnapshot(records);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    return ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) / iterations;
+}
+
+int Benchmark(int iterations)
+{
+    void* ctx = CreateLinuxWatcherContext(OnInserted, OnRemoved, OnMountPointChanged, 1);
+
+    if (!ctx)
+    {
+        printf("Error creating the watcher context. Exiting program.\n");
+        return -1;
+    }
+
+    int count = 0;
+
+    double udev = MeasureSnapshot(ctx, iterations, &count);
+
+    if (SetLinuxWatcherSysfsFastPath(ctx, 1) != 0)
+    {
+        printf("Error opening /sys. Exiting program.\n");
+        ReleaseLinuxWatcherContext(ctx);
+        return -1;
+    }
+
+    double sysfs = MeasureSnapshot(ctx, iterations, &count);
+
+    printf("%d devices, %d iterations\n", count, iterations);
+    printf("libudev: %.1f us per snapshot\n", udev);
+    printf("sysfs:   %.1f us per snapshot\n", sysfs);
+
+    ReleaseLinuxWatcherContext(ctx);
+
+    return 0;
+}
+
+int replayedDevices = 0;
+
+void OnReplayedDevice(const UsbDeviceRecord* usbDevice)
+{
+    replayedDevices++;
+}
+
+// Upper end of the latency bucket that holds the given percentile, in microseconds
+uint64_t GetLatencyPercentile(const uint64_t* histogram, double percentile)
+{
+    uint64_t total = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        total += histogram[i];
+    }
+
+    uint64_t rank = (uint64_t)(total * percentile / 100 + 0.5);
+    uint64_t count = 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        count += histogram[i];
+
+        if (count >= rank && count > 0)
+        {
+            int bucket = i + 1;
+
+            return bucket < (1 << LATENCY_SUB_BUCKET_BITS) ? (uint64_t)bucket :
+                (uint64_t)((1 << LATENCY_SUB_BUCKET_BITS) | (bucket & ((1 << LATENCY_SUB_BUCKET_BITS) - 1))) << ((bucket >> LATENCY_SUB_BUCKET_BITS) - 1);
+        }
+    }
+
+    return 0;
+}
+
+// Feeds an event log through the watcher without printing the devices, and reports the throughput and dispatch latency
+int Replay(const char* path, int maxSpeed)
+{
+    void* ctx = CreateLinuxWatcherContext(OnReplayedDevice, OnReplayedDevice, OnMountPointChanged, 1);
+
+    if (!ctx)
+    {
+        printf("Error creating the watcher context. Exiting program.\n");
+        return -1;
+    }
+
+    if (SetLinuxWatcherReplayFile(ctx, path, maxSpeed) != 0)
+    {
+        printf("Error opening the event log %s. Exiting program.\n", path);
+        ReleaseLinuxWatcherContext(ctx);
+        return -1;
+    }
+
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // Returns once the log has been replayed
+    RunLinuxWatcher(ctx);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    WatcherStats stats;
+    GetLinuxWatcherStats(ctx, &stats);
+
+    printf("%llu events replayed in %.3f s (%.0f events/s)\n",
+        (unsigned long long)stats.EventsReceived, seconds, stats.EventsReceived / seconds);
+    printf("%llu filtered, %llu coalesced, %llu suppressed, %d devices reported\n",
+        (unsigned long long)stats.EventsFiltered, (unsigned long long)stats.EventsCoalesced, (unsigned long long)stats.EventsSuppressed, replayedDevices);
+    printf("Dispatch latency: p50 %llu us, p99 %llu us, p99.9 %llu us\n",
+        (unsigned long long)GetLatencyPercentile(stats.DispatchLatency, 50),
+        (unsigned long long)GetLatencyPercentile(stats.DispatchLatency, 99),
+        (unsigned long long)GetLatencyPercentile(stats.DispatchLatency, 99.9));
+
+    ReleaseLinuxWatcherContext(ctx);
+
+    return 0;
+}
+
+int main(int argc, char* argv[])
 {
     pthread_t thread;
 
+    // UsbEventWatcher --benchmark [iterations] compares the libudev and the sysfs fast path
+    if (argc > 1 && strcmp(argv[1], "--benchmark") == 0)
+    {
+        return Benchmark(argc > 2 && atoi(argv[2]) > 0 ? atoi(argv[2]) : 100);
+    }
+
+    // UsbEventWatcher --replay log [--max-speed] measures the watcher with the events of a log written by --record
+    if (argc > 2 && strcmp(argv[1], "--replay") == 0)
+    {
+        return Replay(argv[2], argc > 3 && strcmp(argv[3], "--max-speed") == 0);
+    }
+
+    // UsbEventWatcher --record log watches the same devices as without arguments and writes their events to log
+    int record = argc > 2 && strcmp(argv[1], "--record") == 0;
+
     printf("USB events: \n");
 
-    int result = pthread_create(&thread, NULL, StartWatcher, NULL);
+    void* ctx = CreateLinuxWatcherContext(OnInserted, OnRemoved, OnMountPointChanged, 0);
+
+    if (!ctx)
+    {
+        printf("Error creating the watcher context. Exiting program.\n");
+        return -1;
+    }
+
+    if (record && SetLinuxWatcherRecordFile(ctx, argv[2]) != 0)
+    {
+        printf("Error creating the event log %s. Exiting program.\n", argv[2]);
+        ReleaseLinuxWatcherContext(ctx);
+        return -1;
+    }
+
+    int result = pthread_create(&thread, NULL, StartWatcher, ctx);
     
     if (result != 0)
     {
         printf("Error creating the thread. Exiting program.\n");
+        ReleaseLinuxWatcherContext(ctx);
         return -1;
     }
 
     getchar();
 
-    StopLinuxWatcher();
+    StopLinuxWatcher(ctx);
 
     pthread_join(thread, NULL);
 
+    ReleaseLinuxWatcherContext(ctx);
+
     return 0;
 }
@@ -1,5 +1,6 @@
 ﻿using System;
 using System.Runtime.InteropServices;
+using System.Text;
 
 namespace Usb.Events
 {
@@ -34,6 +35,136 @@ namespace Usb.Events
         public string VendorID;
     }
 
+    internal enum UsbDeviceField
+    {
+        DeviceName,
+        DeviceSystemPath,
+        Product,
+        ProductDescription,
+        ProductID,
+        SerialNumber,
+        Vendor,
+        VendorDescription,
+        VendorID,
+        Count
+    }
+
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct UsbDeviceRecordField
+    {
+        public ushort Offset;
+        public ushort Length;
+    }
+
+    /// <summary>
+    /// Compact device record of the Linux library: a UInt32 size, then a UsbDeviceRecordField per field, then the packed UTF-8 values
+    /// </summary>
+    internal static unsafe class UsbDeviceRecord
+    {
+        public static byte[] Copy(IntPtr record)
+        {
+            int size = *(int*)record;
+
+            byte[] bytes = new byte[size];
+            Marshal.Copy(record, bytes, 0, size);
+
+            return bytes;
+        }
+
+        public static string GetString(byte[] record, UsbDeviceField field)
+        {
+            fixed (byte* bytes = record)
+            {
+                return GetString(bytes, field);
+            }
+        }
+
+        public static string GetString(byte* record, UsbDeviceField field)
+        {
+            UsbDeviceRecordField entry = GetField(record, field);
+
+            return entry.Length == 0 ? string.Empty : Encoding.UTF8.GetString(record + entry.Offset, entry.Length);
+        }
+
+        /// <summary>
+        /// Compare a field of a native record with a string without decoding the field
+        /// </summary>
+        public static bool FieldEquals(IntPtr record, UsbDeviceField field, string value)
+        {
+            byte* bytes = (byte*)record;
+
+            UsbDeviceRecordField entry = GetField(bytes, field);
+
+            return Utf8Equals(bytes + entry.Offset, entry.Length, value);
+        }
+
+        /// <summary>
+        /// Decode a field through UsbDeviceStringPool, a value that is already in the pool is not decoded again
+        /// </summary>
+        public static string GetInternedString(byte[] record, UsbDeviceField field)
+        {
+            fixed (byte* bytes = record)
+            {
+                UsbDeviceRecordField entry = GetField(bytes, field);
+
+                return UsbDeviceStringPool.GetString(bytes + entry.Offset, entry.Length);
+            }
+        }
+
+        /// <summary>
+        /// Compare UTF-8 bytes with a string without decoding them
+        /// </summary>
+        public static bool Utf8Equals(byte* utf8, int length, string value)
+        {
+            int position = 0;
+
+            for (int i = 0; i < value.Length; ++i)
+            {
+                int codePoint = value[i];
+
+                if (char.IsSurrogate(value[i]))
+                {
+                    if (!char.IsSurrogatePair(value, i))
+                        return Encoding.UTF8.GetString(utf8, length) == value; // Not encodable, compare like the decoder would
+
+                    codePoint = char.ConvertToUtf32(value[i], value[i + 1]);
+                    ++i;
+                }
+                else if (codePoint == 0xFFFD)
+                {
+                    return Encoding.UTF8.GetString(utf8, length) == value; // May stand for invalid bytes in the record
+                }
+
+                int count = codePoint < 0x80 ? 1 : codePoint < 0x800 ? 2 : codePoint < 0x10000 ? 3 : 4;
+
+                if (position + count > length)
+                    return false;
+
+                int shift = 6 * (count - 1);
+
+                byte lead = count == 1 ? (byte)codePoint : (byte)((0xFF00 >> count) | (codePoint >> shift));
+
+                if (utf8[position++] != lead)
+                    return false;
+
+                while (shift > 0)
+                {
+                    shift -= 6;
+
+                    if (utf8[position++] != (byte)(0x80 | ((codePoint >> shift) & 0x3F)))
+                        return false;
+                }
+            }
+
+            return position == length;
+        }
+
+        internal static UsbDeviceRecordField GetField(byte* record, UsbDeviceField field)
+        {
+            return ((UsbDeviceRecordField*)(record + sizeof(uint)))[(int)field];
+        }
+    }
+
     /// <summary>
     /// USB device
     /// </summary>
@@ -42,12 +173,20 @@ namespace Usb.Events
         /// <summary>
         /// Device name
         /// </summary>
-        public string DeviceName { get; internal set; } = string.Empty;
+        public string DeviceName
+        {
+            get => _deviceName ??= GetString(UsbDeviceField.DeviceName);
+            internal set => _deviceName = value;
+        }
 
         /// <summary>
         /// Device system path
         /// </summary>
-        public string DeviceSystemPath { get; internal set; } = string.Empty;
+        public string DeviceSystemPath
+        {
+            get => _deviceSystemPath ??= GetString(UsbDeviceField.DeviceSystemPath);
+            internal set => _deviceSystemPath = value;
+        }
 
         /// <summary>
         /// Device mounted directory path
@@ -57,37 +196,65 @@ namespace Usb.Events
         /// <summary>
         /// Device product name
         /// </summary>
-        public string Product { get; internal set; } = string.Empty;
+        public string Product
+        {
+            get => _product ??= GetString(UsbDeviceField.Product);
+            internal set => _product = value;
+        }
 
         /// <summary>
         /// Device product description
         /// </summary>
-        public string ProductDescription { get; internal set; } = string.Empty;
+        public string ProductDescription
+        {
+            get => _productDescription ??= GetString(UsbDeviceField.ProductDescription);
+            internal set => _productDescription = value;
+        }
 
         /// <summary>
         /// Device product ID
         /// </summary>
-        public string ProductID { get; internal set; } = string.Empty;
+        public string ProductID
+        {
+            get => _productID ??= GetString(UsbDeviceField.ProductID);
+            internal set => _productID = value;
+        }
 
         /// <summary>
         /// Device serial number
         /// </summary>
-        public string SerialNumber { get; internal set; } = string.Empty;
+        public string SerialNumber
+        {
+            get => _serialNumber ??= GetString(UsbDeviceField.SerialNumber);
+            internal set => _serialNumber = value;
+        }
 
         /// <summary>
         /// Device vendor name
         /// </summary>
-        public string Vendor { get; internal set; } = string.Empty;
+        public string Vendor
+        {
+            get => _vendor ??= GetString(UsbDeviceField.Vendor);
+            internal set => _vendor = value;
+        }
 
         /// <summary>
         /// Device vendor description
         /// </summary>
-        public string VendorDescription { get; internal set; } = string.Empty;
+        public string VendorDescription
+        {
+            get => _vendorDescription ??= GetString(UsbDeviceField.VendorDescription);
+            internal set => _vendorDescription = value;
+        }
 
         /// <summary>
         /// Device vendor ID
         /// </summary>
-        public string VendorID { get; internal set; } = string.Empty;
+        public string VendorID
+        {
+            get => _vendorID ??= GetString(UsbDeviceField.VendorID);
+            internal set => _vendorID = value;
+        }
 
         /// <summary>
         /// Is device mounted
@@ -99,6 +266,19 @@ namespace Usb.Events
         /// </summary>
         public bool IsEjected { get; internal set; }
 
+        // Raw record of the Linux library, its fields are decoded on first access
+        private readonly byte[]? _usbDeviceRecord;
+
+        private string? _deviceName;
+        private string? _deviceSystemPath;
+        private string? _product;
+        private string? _productDescription;
+        private string? _productID;
+        private string? _serialNumber;
+        private string? _vendor;
+        private string? _vendorDescription;
+        private string? _vendorID;
+
         /// <summary>
         /// USB device
         /// </summary>
@@ -110,13 +290,30 @@ namespace Usb.Events
         {
             DeviceName = usbDeviceData.DeviceName;
             DeviceSystemPath = usbDeviceData.DeviceSystemPath;
-            Product = usbDeviceData.Product;
-            ProductDescription = usbDeviceData.ProductDescription;
-            ProductID = usbDeviceData.ProductID;
-            SerialNumber = usbDeviceData.SerialNumber;
-            Vendor = usbDeviceData.Vendor;
-            VendorDescription = usbDeviceData.VendorDescription;
-            VendorID = usbDeviceData.VendorID;
+            Product = UsbDeviceStringPool.Intern(usbDeviceData.Product);
+            ProductDescription = UsbDeviceStringPool.Intern(usbDeviceData.ProductDescription);
+            ProductID = UsbDeviceStringPool.Intern(usbDeviceData.ProductID);
+            SerialNumber = UsbDeviceStringPool.Intern(usbDeviceData.SerialNumber);
+            Vendor = UsbDeviceStringPool.Intern(usbDeviceData.Vendor);
+            VendorDescription = UsbDeviceStringPool.Intern(usbDeviceData.VendorDescription);
+            VendorID = UsbDeviceStringPool.Intern(usbDeviceData.VendorID);
+        }
+
+        internal UsbDevice(byte[] usbDeviceRecord)
+        {
+            _usbDeviceRecord = usbDeviceRecord;
+        }
+
+        private string GetString(UsbDeviceField field)
+        {
+            if (_usbDeviceRecord == null)
+                return string.Empty;
+
+            // The name and path differ per device, the other fields repeat across devices and events and share one instance
+            if (field == UsbDeviceField.DeviceName || field == UsbDeviceField.DeviceSystemPath)
+                return UsbDeviceRecord.GetString(_usbDeviceRecord, field);
+
+            return UsbDeviceRecord.GetInternedString(_usbDeviceRecord, field);
         }
 
         /// <summary>
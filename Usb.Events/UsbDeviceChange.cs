@@ -0,0 +1,45 @@
+﻿namespace Usb.Events
+{
+    /// <summary>
+    /// Kind of USB device change
+    /// </summary>
+    public enum UsbDeviceChangeKind
+    {
+        /// <summary>
+        /// The device was added
+        /// </summary>
+        Added,
+
+        /// <summary>
+        /// The device was removed
+        /// </summary>
+        Removed
+    }
+
+    /// <summary>
+    /// USB device change in a UsbDevicesChanged batch
+    /// </summary>
+    public readonly struct UsbDeviceChange
+    {
+        /// <summary>
+        /// Kind of change
+        /// </summary>
+        public UsbDeviceChangeKind Kind { get; }
+
+        /// <summary>
+        /// USB device
+        /// </summary>
+        public UsbDevice Device { get; }
+
+        /// <summary>
+        /// USB device change in a UsbDevicesChanged batch
+        /// </summary>
+        /// <param name="kind">Kind of change</param>
+        /// <param name="device">USB device</param>
+        public UsbDeviceChange(UsbDeviceChangeKind kind, UsbDevice device)
+        {
+            Kind = kind;
+            Device = device;
+        }
+    }
+}
@@ -0,0 +1,66 @@
+﻿using System;
+
+namespace Usb.Events
+{
+    /// <summary>
+    /// UsbDevice properties that are read when a device is reported
+    /// </summary>
+    [Flags]
+    public enum UsbDeviceFields
+    {
+        /// <summary>
+        /// Only the required DeviceName and DeviceSystemPath
+        /// </summary>
+        None = 0,
+
+        /// <summary>
+        /// Device name
+        /// </summary>
+        DeviceName = 1 << 0,
+
+        /// <summary>
+        /// Device system path
+        /// </summary>
+        DeviceSystemPath = 1 << 1,
+
+        /// <summary>
+        /// Product name
+        /// </summary>
+        Product = 1 << 2,
+
+        /// <summary>
+        /// Product description
+        /// </summary>
+        ProductDescription = 1 << 3,
+
+        /// <summary>
+        /// Product ID
+        /// </summary>
+        ProductID = 1 << 4,
+
+        /// <summary>
+        /// Serial number
+        /// </summary>
+        SerialNumber = 1 << 5,
+
+        /// <summary>
+        /// Vendor name
+        /// </summary>
+        Vendor = 1 << 6,
+
+        /// <summary>
+        /// Vendor description
+        /// </summary>
+        VendorDescription = 1 << 7,
+
+        /// <summary>
+        /// Vendor ID
+        /// </summary>
+        VendorID = 1 << 8,
+
+        /// <summary>
+        /// All properties
+        /// </summary>
+        All = DeviceName | DeviceSystemPath | Product | ProductDescription | ProductID | SerialNumber | Vendor | VendorDescription | VendorID
+    }
+}
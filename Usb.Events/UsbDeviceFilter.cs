@@ -0,0 +1,52 @@
+﻿using System.Collections.Generic;
+
+namespace Usb.Events
+{
+    /// <summary>
+    /// USB device vendor and product ID
+    /// </summary>
+    public readonly struct UsbDeviceId
+    {
+        /// <summary>
+        /// Vendor ID
+        /// </summary>
+        public ushort VendorID { get; }
+
+        /// <summary>
+        /// Product ID, null matches every product of the vendor
+        /// </summary>
+        public ushort? ProductID { get; }
+
+        /// <summary>
+        /// USB device vendor and product ID
+        /// </summary>
+        /// <param name="vendorID">Vendor ID</param>
+        /// <param name="productID">Product ID, null matches every product of the vendor</param>
+        public UsbDeviceId(ushort vendorID, ushort? productID = null)
+        {
+            VendorID = vendorID;
+            ProductID = productID;
+        }
+    }
+
+    /// <summary>
+    /// Linux device filter, events of other devices are dropped before they are decoded
+    /// </summary>
+    public class UsbDeviceFilter
+    {
+        /// <summary>
+        /// Devtype in the USB subsystem, for example "usb_device" or "usb_interface", null matches all of them
+        /// </summary>
+        public string? DevType { get; set; }
+
+        /// <summary>
+        /// udev tags, a device must have one of them (up to 16)
+        /// </summary>
+        public List<string> Tags { get; } = new List<string>();
+
+        /// <summary>
+        /// Vendor and product IDs, a device must match one of them (up to 64)
+        /// </summary>
+        public List<UsbDeviceId> DeviceIds { get; } = new List<UsbDeviceId>();
+    }
+}
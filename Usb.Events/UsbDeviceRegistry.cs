@@ -0,0 +1,242 @@
+﻿using System;
+using System.Collections;
+using System.Collections.Generic;
+using System.Collections.ObjectModel;
+using System.Threading;
+
+namespace Usb.Events
+{
+    /// <summary>
+    /// Present USB devices, indexed by system path, device name, serial number and vendor/product ID
+    /// </summary>
+    /// <remarks>
+    /// Reads are lock-free and see an immutable snapshot: every change builds a new one, so that a snapshot is never modified
+    /// while it is enumerated, by the watcher thread or by another reader.
+    /// </remarks>
+    public sealed class UsbDeviceRegistry : IReadOnlyCollection<UsbDevice>
+    {
+        private static readonly UsbDevice[] NoDevices = new UsbDevice[0];
+
+        private sealed class State
+        {
+            private Dictionary<string, UsbDevice[]>? _bySerialNumber;
+            private Dictionary<string, UsbDevice[]>? _byVendorProduct;
+
+            public State()
+                : this(NoDevices, new Dictionary<string, UsbDevice[]>(), new Dictionary<string, UsbDevice[]>(), new Dictionary<uint, UsbDevice[]>())
+            {
+            }
+
+            private State(UsbDevice[] devices, Dictionary<string, UsbDevice[]> bySystemPath, Dictionary<string, UsbDevice[]> byDeviceName, Dictionary<uint, UsbDevice[]> bySystemPathHash)
+            {
+                Devices = new ReadOnlyCollection<UsbDevice>(devices);
+                BySystemPath = bySystemPath;
+                ByDeviceName = byDeviceName;
+                BySystemPathHash = bySystemPathHash;
+            }
+
+            public ReadOnlyCollection<UsbDevice> Devices { get; }
+
+            public Dictionary<string, UsbDevice[]> BySystemPath { get; }
+            public Dictionary<string, UsbDevice[]> ByDeviceName { get; }
+
+            // Finds the device of a native record by the hash of its UTF-8 system path, without decoding it
+            public Dictionary<uint, UsbDevice[]> BySystemPathHash { get; }
+
+            // Built on the first lookup of a snapshot, so that adding and removing devices does not decode their other fields
+            public Dictionary<string, UsbDevice[]> BySerialNumber => LazyInitializer.EnsureInitialized(ref _bySerialNumber, () => BuildIndex(device => device.SerialNumber))!;
+            public Dictionary<string, UsbDevice[]> ByVendorProduct => LazyInitializer.EnsureInitialized(ref _byVendorProduct, () => BuildIndex(device => GetVendorProductKey(device.VendorID, device.ProductID)))!;
+
+            // The indexes of the previous snapshot are copied and only the buckets of the device are changed
+            public State Add(UsbDevice device)
+            {
+                UsbDevice[] devices = new UsbDevice[Devices.Count + 1];
+                Devices.CopyTo(devices, 0);
+                devices[devices.Length - 1] = device;
+
+                State state = new State(devices, new Dictionary<string, UsbDevice[]>(BySystemPath), new Dictionary<string, UsbDevice[]>(ByDeviceName), new Dictionary<uint, UsbDevice[]>(BySystemPathHash));
+
+                AddToIndex(state.BySystemPath, device.DeviceSystemPath, device);
+                AddToIndex(state.ByDeviceName, device.DeviceName, device);
+
+                if (!string.IsNullOrEmpty(device.DeviceSystemPath))
+                    AddToIndex(state.BySystemPathHash, UsbDeviceStringPool.Hash(device.DeviceSystemPath), device);
+
+                return state;
+            }
+
+            public State Remove(HashSet<UsbDevice> removed)
+            {
+                List<UsbDevice> devices = new List<UsbDevice>(Devices.Count);
+
+                foreach (UsbDevice device in Devices)
+                {
+                    if (!removed.Contains(device))
+                        devices.Add(device);
+                }
+
+                if (devices.Count == Devices.Count)
+                    return this;
+
+                State state = new State(devices.ToArray(), new Dictionary<string, UsbDevice[]>(BySystemPath), new Dictionary<string, UsbDevice[]>(ByDeviceName), new Dictionary<uint, UsbDevice[]>(BySystemPathHash));
+
+                foreach (UsbDevice device in removed)
+                {
+                    RemoveFromIndex(state.BySystemPath, device.DeviceSystemPath, device);
+                    RemoveFromIndex(state.ByDeviceName, device.DeviceName, device);
+
+                    if (!string.IsNullOrEmpty(device.DeviceSystemPath))
+                        RemoveFromIndex(state.BySystemPathHash, UsbDeviceStringPool.Hash(device.DeviceSystemPath), device);
+                }
+
+                return state;
+            }
+
+            private Dictionary<string, UsbDevice[]> BuildIndex(Func<UsbDevice, string> getKey)
+            {
+                Dictionary<string, UsbDevice[]> index = new Dictionary<string, UsbDevice[]>();
+
+                foreach (UsbDevice device in Devices)
+                    AddToIndex(index, getKey(device), device);
+
+                return index;
+            }
+
+            private static void AddToIndex<TKey>(Dictionary<TKey, UsbDevice[]> index, TKey key, UsbDevice device)
+            {
+                if (key is string value && string.IsNullOrEmpty(value))
+                    return;
+
+                if (index.TryGetValue(key, out UsbDevice[] devices))
+                {
+                    Array.Resize(ref devices, devices.Length + 1);
+                    devices[devices.Length - 1] = device;
+                }
+                else
+                {
+                    devices = new[] { device };
+                }
+
+                index[key] = devices;
+            }
+
+            // Buckets are shared with older snapshots, so a new array is stored instead of changing the old one
+            private static void RemoveFromIndex<TKey>(Dictionary<TKey, UsbDevice[]> index, TKey key, UsbDevice device)
+            {
+                if ((key is string value && string.IsNullOrEmpty(value)) || !index.TryGetValue(key, out UsbDevice[] devices))
+                    return;
+
+                int position = Array.IndexOf(devices, device);
+
+                if (position == -1)
+                    return;
+
+                if (devices.Length == 1)
+                {
+                    index.Remove(key);
+                    return;
+                }
+
+                UsbDevice[] remaining = new UsbDevice[devices.Length - 1];
+                Array.Copy(devices, 0, remaining, 0, position);
+                Array.Copy(devices, position + 1, remaining, position, remaining.Length - position);
+
+                index[key] = remaining;
+            }
+        }
+
+        private readonly object _writeLock = new object();
+        private State _state = new State();
+
+        /// <summary>
+        /// Immutable snapshot of the present devices
+        /// </summary>
+        public IReadOnlyList<UsbDevice> Snapshot => Volatile.Read(ref _state).Devices;
+
+        /// <summary>
+        /// Number of present devices
+        /// </summary>
+        public int Count => Snapshot.Count;
+
+        /// <summary>
+        /// Devices with a system path
+        /// </summary>
+        public IReadOnlyList<UsbDevice> FindBySystemPath(string systemPath) => Find(Volatile.Read(ref _state).BySystemPath, systemPath);
+
+        /// <summary>
+        /// Devices with a device name
+        /// </summary>
+        public IReadOnlyList<UsbDevice> FindByDeviceName(string deviceName) => Find(Volatile.Read(ref _state).ByDeviceName, deviceName);
+
+        /// <summary>
+        /// Devices with a serial number
+        /// </summary>
+        public IReadOnlyList<UsbDevice> FindBySerialNumber(string serialNumber) => Find(Volatile.Read(ref _state).BySerialNumber, serialNumber);
+
+        /// <summary>
+        /// Devices with a vendor and product ID
+        /// </summary>
+        public IReadOnlyList<UsbDevice> FindByVendorProduct(string vendorID, string productID) => Find(Volatile.Read(ref _state).ByVendorProduct, GetVendorProductKey(vendorID, productID));
+
+        /// <summary>
+        /// Enumerate the snapshot that is current when the enumeration starts
+        /// </summary>
+        public IEnumerator<UsbDevice> GetEnumerator() => Snapshot.GetEnumerator();
+
+        IEnumerator IEnumerable.GetEnumerator() => GetEnumerator();
+
+        /// <summary>
+        /// Is a device with the name and system path of a native Linux record present, the record is not decoded
+        /// </summary>
+        internal unsafe bool Contains(IntPtr usbDeviceRecord)
+        {
+            UsbDeviceRecordField systemPath = UsbDeviceRecord.GetField((byte*)usbDeviceRecord, UsbDeviceField.DeviceSystemPath);
+
+            uint hash = UsbDeviceStringPool.Hash((byte*)usbDeviceRecord + systemPath.Offset, systemPath.Length);
+
+            if (!Volatile.Read(ref _state).BySystemPathHash.TryGetValue(hash, out UsbDevice[] devices))
+                return false;
+
+            foreach (UsbDevice device in devices)
+            {
+                if (UsbDeviceRecord.FieldEquals(usbDeviceRecord, UsbDeviceField.DeviceName, device.DeviceName) &&
+                    UsbDeviceRecord.FieldEquals(usbDeviceRecord, UsbDeviceField.DeviceSystemPath, device.DeviceSystemPath))
+                    return true;
+            }
+
+            return false;
+        }
+
+        internal void Add(UsbDevice device)
+        {
+            lock (_writeLock)
+            {
+                Volatile.Write(ref _state, _state.Add(device));
+            }
+        }
+
+        internal void Remove(IReadOnlyList<UsbDevice> removed)
+        {
+            if (removed.Count == 0)
+                return;
+
+            // UsbDevice has reference equality, so the set holds exactly the removed instances
+            HashSet<UsbDevice> removedSet = new HashSet<UsbDevice>(removed);
+
+            lock (_writeLock)
+            {
+                Volatile.Write(ref _state, _state.Remove(removedSet));
+            }
+        }
+
+        private static IReadOnlyList<UsbDevice> Find(Dictionary<string, UsbDevice[]> index, string key)
+        {
+            return key != null && index.TryGetValue(key, out UsbDevice[] devices) ? devices : NoDevices;
+        }
+
+        private static string GetVendorProductKey(string vendorID, string productID)
+        {
+            return string.IsNullOrEmpty(vendorID) && string.IsNullOrEmpty(productID) ? string.Empty : vendorID + ":" + productID;
+        }
+    }
+}
@@ -0,0 +1,127 @@
+﻿using System;
+using System.Text;
+
+namespace Usb.Events
+{
+    /// <summary>
+    /// Shared instances of the descriptive device strings (vendor, product, IDs, serial number), which repeat across devices and events
+    /// </summary>
+    /// <remarks>
+    /// UTF-8 values of the Linux records are looked up without decoding them, so that a known value costs no allocation.
+    /// The pool is bounded: when it is full it starts over, strings that devices still hold stay valid.
+    /// </remarks>
+    internal static unsafe class UsbDeviceStringPool
+    {
+        private const int BucketCount = 1024;
+        private const int MaxCount = 4096;
+
+        private sealed class Entry
+        {
+            public Entry(string value, int hash, Entry? next)
+            {
+                Value = value;
+                Hash = hash;
+                Next = next;
+            }
+
+            public string Value { get; }
+            public int Hash { get; }
+            public Entry? Next { get; }
+        }
+
+        private static readonly object _lock = new object();
+        private static readonly Entry?[] _buckets = new Entry?[BucketCount];
+        private static int _count;
+
+        /// <summary>
+        /// Get the shared instance of a UTF-8 value, it is only decoded if it is not in the pool yet
+        /// </summary>
+        public static string GetString(byte* utf8, int length)
+        {
+            if (length == 0)
+                return string.Empty;
+
+            uint hash = Hash(utf8, length);
+
+            lock (_lock)
+            {
+                for (Entry? entry = _buckets[hash % BucketCount]; entry != null; entry = entry.Next)
+                {
+                    if (entry.Hash == (int)hash && UsbDeviceRecord.Utf8Equals(utf8, length, entry.Value))
+                        return entry.Value;
+                }
+
+                return Add(Encoding.UTF8.GetString(utf8, length), hash);
+            }
+        }
+
+        /// <summary>
+        /// Get the shared instance of a value
+        /// </summary>
+        public static string Intern(string? value)
+        {
+            if (string.IsNullOrEmpty(value))
+                return string.Empty;
+
+            uint hash = Hash(value!);
+
+            lock (_lock)
+            {
+                for (Entry? entry = _buckets[hash % BucketCount]; entry != null; entry = entry.Next)
+                {
+                    if (entry.Hash == (int)hash && entry.Value == value)
+                        return entry.Value;
+                }
+
+                return Add(value, hash);
+            }
+        }
+
+        /// <summary>
+        /// FNV-1a hash of the ASCII characters of a UTF-8 value, equal to Hash(string) of the decoded value
+        /// </summary>
+        public static uint Hash(byte* utf8, int length)
+        {
+            uint hash = 2166136261;
+
+            for (int i = 0; i < length; i++)
+            {
+                if (utf8[i] < 0x80)
+                    hash = (hash ^ utf8[i]) * 16777619;
+            }
+
+            return hash;
+        }
+
+        /// <summary>
+        /// FNV-1a hash of the ASCII characters of a value, equal to Hash(byte*, int) of its UTF-8 bytes
+        /// </summary>
+        public static uint Hash(string value)
+        {
+            uint hash = 2166136261;
+
+            foreach (char c in value)
+            {
+                if (c < 0x80)
+                    hash = (hash ^ c) * 16777619;
+            }
+
+            return hash;
+        }
+
+        // Must be called with _lock held
+        private static string Add(string value, uint hash)
+        {
+            if (_count == MaxCount)
+            {
+                Array.Clear(_buckets, 0, BucketCount);
+                _count = 0;
+            }
+
+            _buckets[hash % BucketCount] = new Entry(value, (int)hash, _buckets[hash % BucketCount]);
+            _count++;
+
+            return value;
+        }
+    }
+}
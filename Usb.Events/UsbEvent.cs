@@ -0,0 +1,56 @@
+﻿namespace Usb.Events
+{
+    /// <summary>
+    /// Kind of USB event
+    /// </summary>
+    public enum UsbEventKind
+    {
+        /// <summary>
+        /// A USB device was added
+        /// </summary>
+        DeviceAdded,
+
+        /// <summary>
+        /// A USB device was removed
+        /// </summary>
+        DeviceRemoved,
+
+        /// <summary>
+        /// A USB drive was mounted
+        /// </summary>
+        DriveMounted,
+
+        /// <summary>
+        /// A USB drive was ejected
+        /// </summary>
+        DriveEjected
+    }
+
+    /// <summary>
+    /// USB event read from UsbEventWatcher.EventReader
+    /// </summary>
+    public readonly struct UsbEvent
+    {
+        /// <summary>
+        /// Kind of event
+        /// </summary>
+        public UsbEventKind Kind { get; }
+
+        /// <summary>
+        /// USB device of a DeviceAdded or DeviceRemoved event
+        /// </summary>
+        public UsbDevice? Device { get; }
+
+        /// <summary>
+        /// Drive path of a DriveMounted or DriveEjected event
+        /// </summary>
+        public string? DrivePath { get; }
+
+        internal UsbEvent(UsbEventKind kind, UsbDevice? device, string? drivePath)
+        {
+            Kind = kind;
+            Device = device;
+            DrivePath = drivePath;
+        }
+    }
+}
@@ -0,0 +1,132 @@
+﻿using System;
+using System.Collections.Concurrent;
+using System.Threading;
+
+namespace Usb.Events
+{
+    /// <summary>
+    /// Runs event handlers on a pool of threads, sharded by device key
+    /// </summary>
+    /// <remarks>
+    /// The events of one device always go to the same thread, so they run in order, while the events of other devices run in parallel.
+    /// Disposing it lets the threads run the queued events, then waits for them.
+    /// </remarks>
+    internal sealed class UsbEventDispatcher : IDisposable
+    {
+        private readonly BlockingCollection<Action>[] _queues;
+        private readonly Thread[] _threads;
+        private long _queueLength;
+        private long _peakQueueLength;
+        private long _dispatchedCount;
+
+        public UsbEventDispatcher(int threadCount)
+        {
+            if (threadCount <= 0)
+                throw new ArgumentOutOfRangeException(nameof(threadCount));
+
+            _queues = new BlockingCollection<Action>[threadCount];
+            _threads = new Thread[threadCount];
+
+            for (int i = 0; i < threadCount; i++)
+            {
+                _queues[i] = new BlockingCollection<Action>();
+                _threads[i] = new Thread(Run)
+                {
+                    IsBackground = true,
+                    Name = "Usb.Events dispatcher " + i
+                };
+                _threads[i].Start(_queues[i]);
+            }
+        }
+
+        /// <summary>
+        /// Number of events waiting in all shards
+        /// </summary>
+        public long QueueLength => Interlocked.Read(ref _queueLength);
+
+        /// <summary>
+        /// Highest QueueLength so far
+        /// </summary>
+        public long PeakQueueLength => Interlocked.Read(ref _peakQueueLength);
+
+        /// <summary>
+        /// Number of events whose handlers have run
+        /// </summary>
+        public long DispatchedCount => Interlocked.Read(ref _dispatchedCount);
+
+        /// <summary>
+        /// Get the number of events waiting in each shard
+        /// </summary>
+        public int[] GetShardQueueLengths()
+        {
+            int[] lengths = new int[_queues.Length];
+
+            for (int i = 0; i < _queues.Length; i++)
+                lengths[i] = _queues[i].Count;
+
+            return lengths;
+        }
+
+        /// <summary>
+        /// Queue an event handler on the shard of a device key
+        /// </summary>
+        public void Post(string key, Action action)
+        {
+            BlockingCollection<Action> queue = _queues[(key.GetHashCode() & int.MaxValue) % _queues.Length];
+
+            long length = Interlocked.Increment(ref _queueLength);
+
+            long peak;
+            while (length > (peak = Interlocked.Read(ref _peakQueueLength)) && Interlocked.CompareExchange(ref _peakQueueLength, length, peak) != peak)
+            {
+            }
+
+            try
+            {
+                queue.Add(action);
+            }
+            catch (InvalidOperationException)
+            {
+                // Disposed, the watcher is stopping
+                Interlocked.Decrement(ref _queueLength);
+            }
+        }
+
+        private void Run(object? state)
+        {
+            BlockingCollection<Action> queue = (BlockingCollection<Action>)state!;
+
+            foreach (Action action in queue.GetConsumingEnumerable())
+            {
+                Interlocked.Decrement(ref _queueLength);
+
+                action();
+
+                Interlocked.Increment(ref _dispatchedCount);
+            }
+        }
+
+        public void Dispose()
+        {
+            foreach (BlockingCollection<Action> queue in _queues)
+                queue.CompleteAdding();
+
+            // A handler that disposes the watcher runs on one of the threads, which cannot wait for itself or dispose the queue it reads
+            bool joinedAll = true;
+
+            foreach (Thread thread in _threads)
+            {
+                if (thread == Thread.CurrentThread)
+                    joinedAll = false;
+                else
+                    thread.Join();
+            }
+
+            if (joinedAll)
+            {
+                foreach (BlockingCollection<Action> queue in _queues)
+                    queue.Dispose();
+            }
+        }
+    }
+}
@@ -0,0 +1,23 @@
+﻿namespace Usb.Events
+{
+    /// <summary>
+    /// What the Linux event queue does when the application does not keep up with the events
+    /// </summary>
+    public enum UsbEventQueueOverflowPolicy
+    {
+        /// <summary>
+        /// The oldest queued event is discarded
+        /// </summary>
+        DropOldest,
+
+        /// <summary>
+        /// The native monitor waits until an event has been handled
+        /// </summary>
+        Block,
+
+        /// <summary>
+        /// Events wait outside the queue and only the newest event of each device is kept
+        /// </summary>
+        Coalesce
+    }
+}
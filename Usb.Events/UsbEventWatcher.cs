@@ -4,7 +4,9 @@ using System.IO;
 using System.Linq;
 using System.Management;
 using System.Runtime.InteropServices;
+using System.Text;
 using System.Threading;
+using System.Threading.Channels;
 using System.Threading.Tasks;
 
 namespace Usb.Events
@@ -26,9 +28,20 @@ namespace Usb.Events
         public List<string> UsbDrivePathList { get; private set; } = new List<string>();
 
         /// <summary>
-        /// List of USB devices
+        /// Copy of Devices.Snapshot: it is no longer the live list of the watcher, every call allocates a new list and changing it has no effect
         /// </summary>
-        public List<UsbDevice> UsbDeviceList { get; private set; } = new List<UsbDevice>();
+        [Obsolete("UsbDeviceList is a copy that is not updated and ignores changes, use Devices instead")]
+        public List<UsbDevice> UsbDeviceList => new List<UsbDevice>(Devices.Snapshot);
+
+        /// <summary>
+        /// Present USB devices, with lock-free snapshots and lookups by system path, device name, serial number and vendor/product ID
+        /// </summary>
+        public UsbDeviceRegistry Devices { get; } = new UsbDeviceRegistry();
+
+        /// <summary>
+        /// Reader of all events when UsbEventWatcherOptions.EventChannelCapacity is set, completed when the watcher is disposed
+        /// </summary>
+        public ChannelReader<UsbEvent>? EventReader => _eventChannel?.Reader;
 
         /// <summary>
         /// USB drive mounted event
@@ -50,8 +63,63 @@ namespace Usb.Events
         /// </summary>
         public event EventHandler<UsbDevice>? UsbDeviceRemoved;
 
+        /// <summary>
+        /// USB devices changed event, raised once for all the devices added or removed together
+        /// </summary>
+        public event EventHandler<IReadOnlyList<UsbDeviceChange>>? UsbDevicesChanged;
+
         #endregion
 
+        /// <summary>
+        /// Number of add and remove events that were collapsed by UsbEventWatcherOptions.DebounceWindow in Linux
+        /// </summary>
+        public long SuppressedEventCount => _linuxWatcherContext != IntPtr.Zero ? (long)GetLinuxWatcherSuppressedEvents(_linuxWatcherContext) : 0;
+
+        /// <summary>
+        /// Number of events that found the Linux event queue full
+        /// </summary>
+        public long QueueOverflowCount => _linuxWatcherContext != IntPtr.Zero ? (long)GetLinuxWatcherQueueOverflows(_linuxWatcherContext) : 0;
+
+        /// <summary>
+        /// Number of times the devices were re-enumerated in Linux because udev events were lost
+        /// </summary>
+        public long ResyncCount => _linuxWatcherContext != IntPtr.Zero ? (long)GetLinuxWatcherResyncs(_linuxWatcherContext) : 0;
+
+        /// <summary>
+        /// Event counters and latency histograms of the Linux watcher, read when the property is read
+        /// </summary>
+        public UsbEventWatcherStatistics Statistics => _linuxWatcherContext != IntPtr.Zero ? GetStatistics(_linuxWatcherContext) : new UsbEventWatcherStatistics();
+
+        /// <summary>
+        /// Number of events waiting for a UsbEventWatcherOptions.DispatcherThreads thread
+        /// </summary>
+        public long DispatchQueueLength => _dispatcher?.QueueLength ?? 0;
+
+        /// <summary>
+        /// Highest DispatchQueueLength since the watcher started
+        /// </summary>
+        public long DispatchQueuePeak => _dispatcher?.PeakQueueLength ?? 0;
+
+        /// <summary>
+        /// Number of events whose handlers have run on a UsbEventWatcherOptions.DispatcherThreads thread
+        /// </summary>
+        public long DispatchedEventCount => _dispatcher?.DispatchedCount ?? 0;
+
+        /// <summary>
+        /// Number of events waiting for each UsbEventWatcherOptions.DispatcherThreads thread
+        /// </summary>
+        public int[] GetDispatchQueueLengths() => _dispatcher?.GetShardQueueLengths() ?? Array.Empty<int>();
+
+        /// <summary>
+        /// Number of vendor and product descriptions in Linux that were found in the description cache shared by all watchers
+        /// </summary>
+        public static long DescriptionCacheHits => RuntimeInformation.IsOSPlatform(OSPlatform.Linux) ? (long)GetDescriptionCacheStats().Hits : 0;
+
+        /// <summary>
+        /// Number of vendor and product descriptions in Linux that were not in the description cache and were read from the udev properties
+        /// </summary>
+        public static long DescriptionCacheMisses => RuntimeInformation.IsOSPlatform(OSPlatform.Linux) ? (long)GetDescriptionCacheStats().Misses : 0;
+
         #region Windows fields
 
         private ManagementEventWatcher? _volumeChangeEventWatcher;
@@ -65,17 +133,20 @@ namespace Usb.Events
 
         private Task? _watcherTask;
         private Task? _mountPointTask;
+        private Task? _eventQueueTask;
 
         #endregion
 
         private CancellationTokenSource? _cancellationTokenSource;
+        private Channel<UsbEvent>? _eventChannel;
+        private UsbEventDispatcher? _dispatcher;
         private bool _isRunning;
 
         /// <summary>
         /// Main Usb.Events class
         /// </summary>
         /// <param name="startImmediately">Set startImmediately to false if you don't want to start immediately, then call Start()</param>
-        /// <param name="addAlreadyPresentDevicesToList">Set addAlreadyPresentDevicesToList to true to include already present devices in UsbDeviceList</param>
+        /// <param name="addAlreadyPresentDevicesToList">Set addAlreadyPresentDevicesToList to true to include already present devices in Devices</param>
         /// <param name="usePnPEntity">Set usePnPEntity to true to query Win32_PnPEntity instead of Win32_USBControllerDevice in Windows</param>
         /// <param name="includeTTY">Set includeTTY to true to monitor the TTY subsystem in Linux (besides the USB subsystem)</param>
         public UsbEventWatcher(bool startImmediately = true, bool addAlreadyPresentDevicesToList = false, bool usePnPEntity = false, bool includeTTY = false)
@@ -86,29 +157,76 @@ namespace Usb.Events
             }
         }
 
+        /// <summary>
+        /// Main Usb.Events class
+        /// </summary>
+        /// <param name="options">Watcher options</param>
+        /// <param name="startImmediately">Set startImmediately to false if you don't want to start immediately, then call Start()</param>
+        public UsbEventWatcher(UsbEventWatcherOptions options, bool startImmediately = true)
+        {
+            if (startImmediately)
+            {
+                Start(options);
+            }
+        }
+
         #region Methods
 
         /// <summary>
         /// Start monitoring USB events
         /// </summary>
-        /// <param name="addAlreadyPresentDevicesToList">Set addAlreadyPresentDevicesToList to true to include already present devices in UsbDeviceList</param>
+        /// <param name="addAlreadyPresentDevicesToList">Set addAlreadyPresentDevicesToList to true to include already present devices in Devices</param>
         /// <param name="usePnPEntity">Set usePnPEntity to true to query Win32_PnPEntity instead of Win32_USBControllerDevice in Windows</param>
         /// <param name="includeTTY">Set includeTTY to true to monitor the TTY subsystem in Linux (besides the USB subsystem)</param>
         public void Start(bool addAlreadyPresentDevicesToList = false, bool usePnPEntity = false, bool includeTTY = false)
         {
+            Start(new UsbEventWatcherOptions
+            {
+                AddAlreadyPresentDevicesToList = addAlreadyPresentDevicesToList,
+                UsePnPEntity = usePnPEntity,
+                IncludeTTY = includeTTY
+            });
+        }
+
+        /// <summary>
+        /// Start monitoring USB events
+        /// </summary>
+        /// <param name="options">Watcher options</param>
+        public void Start(UsbEventWatcherOptions options)
+        {
+            if (options == null)
+                throw new ArgumentNullException(nameof(options));
+
             if (_isRunning)
                 return;
 
+            // Waiting for the consumer must not hold the thread that receives the native events, only the reader of the Linux event queue may wait
+            if (options.EventChannelCapacity > 0 && options.EventChannelFullMode == BoundedChannelFullMode.Wait &&
+                !(RuntimeInformation.IsOSPlatform(OSPlatform.Linux) && options.EventQueueCapacity > 0))
+                throw new ArgumentException("The Wait channel full mode needs the Linux event queue", nameof(options));
+
             _isRunning = true;
 
+            if (options.DispatcherThreads > 0)
+                _dispatcher = new UsbEventDispatcher(options.DispatcherThreads);
+
+            // Created before the watcher starts, so that the already present devices are written to it too
+            if (options.EventChannelCapacity > 0)
+            {
+                _eventChannel = Channel.CreateBounded<UsbEvent>(new BoundedChannelOptions(options.EventChannelCapacity)
+                {
+                    FullMode = options.EventChannelFullMode
+                });
+            }
+
             if (RuntimeInformation.IsOSPlatform(OSPlatform.Windows))
             {
-                if (addAlreadyPresentDevicesToList)
+                if (options.AddAlreadyPresentDevicesToList)
                 {
                     AddAlreadyPresentDevicesToList();
                 }
 
-                StartWindowsWatcher(usePnPEntity);
+                StartWindowsWatcher(options.UsePnPEntity);
             }
             else if (RuntimeInformation.IsOSPlatform(OSPlatform.OSX))
             {
@@ -129,16 +247,10 @@ namespace Usb.Events
                 {
                     while (!_cancellationTokenSource.Token.IsCancellationRequested)
                     {
-                        try
-                        {
-                            foreach (UsbDevice usbDevice in UsbDeviceList.Where(device => !string.IsNullOrEmpty(device.DeviceSystemPath)).ToList())
-                            {
-                                GetMacMountPoint(usbDevice.DeviceSystemPath, mountPoint => SetMountPoint(usbDevice, mountPoint));
-                            }
-                        }
-                        catch (InvalidOperationException)
+                        // The snapshot does not change while it is enumerated, even when the watcher thread adds or removes devices
+                        foreach (UsbDevice usbDevice in Devices.Snapshot.Where(device => !string.IsNullOrEmpty(device.DeviceSystemPath)))
                         {
-                            // Prevent application crash and ignore possible exception when collection was changed because this may happen by another thread or task
+                            GetMacMountPoint(usbDevice.DeviceSystemPath, mountPoint => SetMountPoint(usbDevice, mountPoint));
                         }
 
                         await Task.Delay(1000, _cancellationTokenSource.Token);
@@ -147,32 +259,132 @@ namespace Usb.Events
             }
             else if (RuntimeInformation.IsOSPlatform(OSPlatform.Linux))
             {
-                _watcherTask = Task.Run(() => StartLinuxWatcher(InsertedCallback, RemovedCallback, includeTTY));
+                // The native watcher reports mount point changes itself, when the kernel signals a change of the mount table
+                _insertedRecordCallbackDelegate = InsertedRecordCallback;
+                _removedRecordCallbackDelegate = RemovedRecordCallback;
+                _mountPointChangedCallbackDelegate = MountPointChanged;
 
-                _cancellationTokenSource = new CancellationTokenSource();
+                _linuxWatcherContext = CreateLinuxWatcherContext(_insertedRecordCallbackDelegate, _removedRecordCallbackDelegate, _mountPointChangedCallbackDelegate, options.IncludeTTY);
 
-                _mountPointTask = Task.Run(async () => 
+                if (_linuxWatcherContext != IntPtr.Zero)
                 {
-                    while (!_cancellationTokenSource.Token.IsCancellationRequested)
+                    SetLinuxWatcherFieldMask(_linuxWatcherContext, (uint)options.Fields);
+                    SetLinuxWatcherCoalesceDevices(_linuxWatcherContext, options.CoalesceDevices);
+                    SetLinuxWatcherEnumerationThreads(_linuxWatcherContext, options.EnumerationThreads);
+
+                    // Without /sys the fields are read through libudev as before
+                    if (options.UseSysfsFastPath)
+                        SetLinuxWatcherSysfsFastPath(_linuxWatcherContext, true);
+                    SetLinuxWatcherDebounce(_linuxWatcherContext, (int)Math.Min(options.DebounceWindow.TotalMilliseconds, int.MaxValue));
+                    SetLinuxWatcherReceiveBufferSize(_linuxWatcherContext, options.ReceiveBufferSize);
+
+                    if (options.Filter != null && !SetLinuxWatcherFilter(_linuxWatcherContext, options.Filter))
                     {
-                        try
-                        {
-                            foreach (UsbDevice usbDevice in UsbDeviceList.Where(device => !string.IsNullOrEmpty(device.DeviceSystemPath)).ToList())
-                            {
-                                GetLinuxMountPoint(usbDevice.DeviceSystemPath, mountPoint => SetMountPoint(usbDevice, mountPoint));
-                            }
-                        }
-                        catch (InvalidOperationException)
+                        ReleaseLinuxWatcherContext(_linuxWatcherContext);
+                        _linuxWatcherContext = IntPtr.Zero;
+                        _isRunning = false;
+
+                        throw new ArgumentException("Invalid device filter or too many tags or device IDs", nameof(options));
+                    }
+
+                    if ((options.RecordFile != null && SetLinuxWatcherRecordFile(_linuxWatcherContext, options.RecordFile) != 0) ||
+                        (options.ReplayFile != null && SetLinuxWatcherReplayFile(_linuxWatcherContext, options.ReplayFile, options.ReplayAtMaximumSpeed) != 0))
+                    {
+                        ReleaseLinuxWatcherContext(_linuxWatcherContext);
+                        _linuxWatcherContext = IntPtr.Zero;
+                        _isRunning = false;
+
+                        throw new IOException("The event log could not be created or is not an event log");
+                    }
+
+                    if (options.EventQueueCapacity > 0)
+                    {
+                        if (SetLinuxWatcherEventQueue(_linuxWatcherContext, options.EventQueueCapacity, (int)options.EventQueueOverflowPolicy) != 0)
                         {
-                            // Prevent application crash and ignore possible exception when collection was changed because this may happen by another thread or task
+                            ReleaseLinuxWatcherContext(_linuxWatcherContext);
+                            _linuxWatcherContext = IntPtr.Zero;
+                            _isRunning = false;
+
+                            throw new ArgumentException("Invalid event queue capacity or overflow policy", nameof(options));
                         }
 
-                        await Task.Delay(1000, _cancellationTokenSource.Token);
+                        // Started before the watcher, so that already present devices are read while they are enumerated
+                        _eventQueueTask = Task.Factory.StartNew(ReadLinuxWatcherEvents, TaskCreationOptions.LongRunning);
                     }
-                }, _cancellationTokenSource.Token);
+                    else
+                    {
+                        // One call per udev wakeup instead of one per device
+                        _batchCallbackDelegate = BatchCallback;
+                        SetLinuxWatcherBatchCallback(_linuxWatcherContext, _batchCallbackDelegate);
+                    }
+                }
+
+                _watcherTask = Task.Run(() =>
+                {
+                    if (_linuxWatcherContext != IntPtr.Zero)
+                        RunLinuxWatcher(_linuxWatcherContext);
+                });
             }
         }
 
+        /// <summary>
+        /// Get the devices that are present now, in one call and without raising events
+        /// </summary>
+        /// <returns>In Linux the devices enumerated with the device selection of the running watcher, otherwise Devices.Snapshot</returns>
+        public IReadOnlyList<UsbDevice> GetSnapshot()
+        {
+            if (RuntimeInformation.IsOSPlatform(OSPlatform.Linux))
+                return GetLinuxSnapshot(_linuxWatcherContext);
+
+            return Devices.Snapshot;
+        }
+
+        /// <summary>
+        /// Compare two snapshots
+        /// </summary>
+        /// <param name="previous">Earlier snapshot</param>
+        /// <param name="current">Later snapshot</param>
+        /// <returns>The devices that are only in current as added, then the devices that are only in previous as removed</returns>
+        public static IReadOnlyList<UsbDeviceChange> Diff(IReadOnlyList<UsbDevice> previous, IReadOnlyList<UsbDevice> current)
+        {
+            if (previous == null)
+                throw new ArgumentNullException(nameof(previous));
+
+            if (current == null)
+                throw new ArgumentNullException(nameof(current));
+
+            HashSet<string> previousKeys = new HashSet<string>(previous.Select(GetDeviceKey));
+            HashSet<string> currentKeys = new HashSet<string>(current.Select(GetDeviceKey));
+
+            List<UsbDeviceChange> changes = new List<UsbDeviceChange>();
+
+            foreach (UsbDevice device in current)
+            {
+                if (!previousKeys.Contains(GetDeviceKey(device)))
+                    changes.Add(new UsbDeviceChange(UsbDeviceChangeKind.Added, device));
+            }
+
+            foreach (UsbDevice device in previous)
+            {
+                if (!currentKeys.Contains(GetDeviceKey(device)))
+                    changes.Add(new UsbDeviceChange(UsbDeviceChangeKind.Removed, device));
+            }
+
+            return changes;
+        }
+
+        // Identifies a device the way OnDeviceRemoved finds it in Devices
+        private static string GetDeviceKey(UsbDevice device)
+        {
+            if (RuntimeInformation.IsOSPlatform(OSPlatform.OSX))
+                return device.ProductID + "\n" + device.VendorID + "\n" + device.SerialNumber;
+
+            if (RuntimeInformation.IsOSPlatform(OSPlatform.Windows))
+                return device.SerialNumber;
+
+            return device.DeviceName + "\n" + device.DeviceSystemPath;
+        }
+
         private void SetMountPoint(UsbDevice usbDevice, string mountPoint)
         {
             if (string.IsNullOrEmpty(usbDevice.MountedDirectoryPath) && !string.IsNullOrEmpty(mountPoint))
@@ -197,76 +409,450 @@ namespace Usb.Events
         {
             UsbDriveMounted?.Invoke(this, path);
             UsbDrivePathList.Add(path);
+
+            WriteEvent(new UsbEvent(UsbEventKind.DriveMounted, null, path));
         }
 
         private void OnDriveRemoved(string path)
         {
             UsbDriveEjected?.Invoke(this, path);
             UsbDrivePathList.RemoveAll(p => p == path);
+
+            WriteEvent(new UsbEvent(UsbEventKind.DriveEjected, null, path));
+        }
+
+        private void WriteEvent(UsbEvent usbEvent)
+        {
+            ChannelWriter<UsbEvent>? writer = _eventChannel?.Writer;
+
+            if (writer == null)
+                return;
+
+            // TryWrite fails only when the channel is full in the Wait mode or completed, Start allows Wait only on the event queue reader thread
+            while (!writer.TryWrite(usbEvent))
+            {
+                if (!writer.WaitToWriteAsync().AsTask().GetAwaiter().GetResult())
+                    return;
+            }
+        }
+
+        private void Dispatch(EventHandler<UsbDevice>? handler, UsbDevice usbDevice)
+        {
+            if (handler == null)
+                return;
+
+            if (_dispatcher != null)
+                _dispatcher.Post(GetDeviceKey(usbDevice), () => handler(this, usbDevice));
+            else
+                handler(this, usbDevice);
         }
 
+        // Without a dispatcher the handler runs first, like it always did. With one it runs later on a shard thread,
+        // so Devices and UsbDevicesChanged are updated before it is posted, and the handler sees the device state of its event
         private void OnDeviceInserted(UsbDevice usbDevice)
         {
-            UsbDeviceAdded?.Invoke(this, usbDevice);
-            UsbDeviceList.Add(usbDevice);
+            if (_dispatcher == null)
+            {
+                Dispatch(UsbDeviceAdded, usbDevice);
+                Devices.Add(usbDevice);
+                OnDeviceChanged(new UsbDeviceChange(UsbDeviceChangeKind.Added, usbDevice));
+            }
+            else
+            {
+                Devices.Add(usbDevice);
+                OnDeviceChanged(new UsbDeviceChange(UsbDeviceChangeKind.Added, usbDevice));
+                Dispatch(UsbDeviceAdded, usbDevice);
+            }
+
+            WriteEvent(new UsbEvent(UsbEventKind.DeviceAdded, usbDevice, null));
         }
 
         private void OnDeviceRemoved(UsbDevice usbDevice)
         {
-            UsbDeviceRemoved?.Invoke(this, usbDevice);
+            if (_dispatcher == null)
+            {
+                Dispatch(UsbDeviceRemoved, usbDevice);
+                OnDeviceChanged(new UsbDeviceChange(UsbDeviceChangeKind.Removed, usbDevice));
+                RemoveFromDevices(usbDevice);
+            }
+            else
+            {
+                RemoveFromDevices(usbDevice);
+                OnDeviceChanged(new UsbDeviceChange(UsbDeviceChangeKind.Removed, usbDevice));
+                Dispatch(UsbDeviceRemoved, usbDevice);
+            }
+
+            WriteEvent(new UsbEvent(UsbEventKind.DeviceRemoved, usbDevice, null));
+        }
 
+        private void RemoveFromDevices(UsbDevice usbDevice)
+        {
             if (RuntimeInformation.IsOSPlatform(OSPlatform.Linux))
             {
-                UsbDeviceList.RemoveAll(device => device.DeviceName == usbDevice.DeviceName && device.DeviceSystemPath == usbDevice.DeviceSystemPath);
+                Devices.Remove(Devices.FindBySystemPath(usbDevice.DeviceSystemPath).Where(device => device.DeviceName == usbDevice.DeviceName).ToList());
             }
             else if (RuntimeInformation.IsOSPlatform(OSPlatform.OSX))
             {
-                UsbDeviceList.RemoveAll(device => device.ProductID == usbDevice.ProductID && device.VendorID == usbDevice.VendorID && device.SerialNumber == usbDevice.SerialNumber);
+                Devices.Remove(Devices.FindByVendorProduct(usbDevice.VendorID, usbDevice.ProductID).Where(device => device.SerialNumber == usbDevice.SerialNumber).ToList());
             }
             else if (RuntimeInformation.IsOSPlatform(OSPlatform.Windows))
             {
-                UsbDeviceList.RemoveAll(device => device.SerialNumber == usbDevice.SerialNumber);
+                Devices.Remove(Devices.FindBySerialNumber(usbDevice.SerialNumber));
             }
         }
 
+        // Changes are collected while the Linux watcher delivers a batch, otherwise every change is a batch of its own
+        private List<UsbDeviceChange>? _deviceChangeBatch;
+
+        private void OnDeviceChanged(UsbDeviceChange change)
+        {
+            if (_deviceChangeBatch != null)
+                _deviceChangeBatch.Add(change);
+            else
+                UsbDevicesChanged?.Invoke(this, new[] { change });
+        }
+
+        private void BeginDeviceChangeBatch()
+        {
+            _deviceChangeBatch = new List<UsbDeviceChange>();
+        }
+
+        private void FlushDeviceChangeBatch()
+        {
+            if (_deviceChangeBatch == null || _deviceChangeBatch.Count == 0)
+                return;
+
+            List<UsbDeviceChange> changes = _deviceChangeBatch;
+            _deviceChangeBatch = new List<UsbDeviceChange>();
+
+            UsbDevicesChanged?.Invoke(this, changes);
+        }
+
+        private void EndDeviceChangeBatch()
+        {
+            FlushDeviceChangeBatch();
+            _deviceChangeBatch = null;
+        }
+
         #endregion
 
         #region Linux and Mac methods
 
-        // CHANGED: Use 'ref' to match pointer passing (Pass-by-Reference)
+        // The macOS library passes a const UsbDeviceData* - 'ref' matches the pointer and [In] stops the marshaller from copying the struct back
         [UnmanagedFunctionPointer(CallingConvention.Cdecl, CharSet = CharSet.Auto)]
-        delegate void UsbDeviceCallback(ref UsbDeviceData usbDevice);
+        delegate void UsbDeviceCallback([In] ref UsbDeviceData usbDevice);
+
+        // The Linux library passes a const UsbDeviceRecord* that is only valid during the call
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        delegate void UsbDeviceRecordCallback(IntPtr usbDeviceRecord);
+
+        // The Linux library passes the events of one wakeup as an array of UsbDeviceEvent, valid during the call
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
+        delegate void UsbDeviceBatchCallback(IntPtr events, int count);
+
+        [StructLayout(LayoutKind.Sequential)]
+        private struct UsbDeviceEvent
+        {
+            public int Kind;
+            public IntPtr Record;
+        }
 
         [UnmanagedFunctionPointer(CallingConvention.Cdecl, CharSet = CharSet.Auto)]
         delegate void MountPointCallback(string mountPoint);
 
+        [UnmanagedFunctionPointer(CallingConvention.Cdecl, CharSet = CharSet.Auto)]
+        delegate void MountPointChangedCallback(string syspath, string mountPoint);
+
         // ADDED: Field to hold the unmanaged context and to keep delegates alive (prevent GC collection)
         private IntPtr _macWatcherContext = IntPtr.Zero;
+        private IntPtr _linuxWatcherContext = IntPtr.Zero;
         private UsbDeviceCallback? _insertedCallbackDelegate;
         private UsbDeviceCallback? _removedCallbackDelegate;
+        private UsbDeviceRecordCallback? _insertedRecordCallbackDelegate;
+        private UsbDeviceRecordCallback? _removedRecordCallbackDelegate;
+        private MountPointChangedCallback? _mountPointChangedCallbackDelegate;
+        private UsbDeviceBatchCallback? _batchCallbackDelegate;
 
-        private void InsertedCallback(ref UsbDeviceData usbDevice)
+        private void InsertedCallback([In] ref UsbDeviceData usbDevice)
         {
             var data = usbDevice;
-            if (UsbDeviceList.Any(device => device.DeviceName == data.DeviceName && device.DeviceSystemPath == data.DeviceSystemPath))
+            if (Devices.FindBySystemPath(data.DeviceSystemPath).Any(device => device.DeviceName == data.DeviceName))
                 return;
 
             OnDeviceInserted(new UsbDevice(data));
         }
 
-        private void RemovedCallback(ref UsbDeviceData usbDevice)
+        private void RemovedCallback([In] ref UsbDeviceData usbDevice)
         {
             OnDeviceRemoved(new UsbDevice(usbDevice));
         }
+
+        private void InsertedRecordCallback(IntPtr usbDeviceRecord)
+        {
+            // Looked up by the hash of the record's system path and compared in place, so that a duplicate event is dropped without allocating
+            if (Devices.Contains(usbDeviceRecord))
+                return;
+
+            OnDeviceInserted(new UsbDevice(UsbDeviceRecord.Copy(usbDeviceRecord)));
+        }
+
+        private void RemovedRecordCallback(IntPtr usbDeviceRecord)
+        {
+            OnDeviceRemoved(new UsbDevice(UsbDeviceRecord.Copy(usbDeviceRecord)));
+        }
+
+        private unsafe void BatchCallback(IntPtr events, int count)
+        {
+            UsbDeviceEvent* usbDeviceEvents = (UsbDeviceEvent*)events;
+
+            BeginDeviceChangeBatch();
+
+            try
+            {
+                for (int i = 0; i < count; i++)
+                {
+                    if ((LinuxWatcherEventKind)usbDeviceEvents[i].Kind == LinuxWatcherEventKind.Inserted)
+                        InsertedRecordCallback(usbDeviceEvents[i].Record);
+                    else if ((LinuxWatcherEventKind)usbDeviceEvents[i].Kind == LinuxWatcherEventKind.Removed)
+                        RemovedRecordCallback(usbDeviceEvents[i].Record);
+                }
+            }
+            finally
+            {
+                EndDeviceChangeBatch();
+            }
+        }
+
+        private static unsafe List<UsbDevice> GetLinuxSnapshot(IntPtr ctx)
+        {
+            int count = SnapshotLinuxDevices(ctx, out IntPtr records, out int size);
+
+            if (count < 0)
+                throw new InvalidOperationException("The USB devices could not be enumerated");
+
+            List<UsbDevice> devices = new List<UsbDevice>(count);
+
+            try
+            {
+                byte* record = (byte*)records;
+
+                for (int i = 0; i < count; i++)
+                {
+                    devices.Add(new UsbDevice(UsbDeviceRecord.Copy((IntPtr)record)));
+
+                    // Each record starts at a 4-byte aligned offset
+                    record += (*(int*)record + 3) & ~3;
+                }
+            }
+            finally
+            {
+                FreeLinuxDeviceSnapshot(records);
+            }
+
+            return devices;
+        }
+
+        private static UsbEventWatcherStatistics GetStatistics(IntPtr ctx)
+        {
+            GetLinuxWatcherStats(ctx, out LinuxWatcherStats stats);
+
+            return new UsbEventWatcherStatistics(stats);
+        }
+
+        private static (ulong Hits, ulong Misses) GetDescriptionCacheStats()
+        {
+            GetLinuxDescriptionCacheStats(out ulong hits, out ulong misses, IntPtr.Zero);
+
+            return (hits, misses);
+        }
+
+        private static bool SetLinuxWatcherFilter(IntPtr ctx, UsbDeviceFilter filter)
+        {
+            if (filter.DevType != null && SetLinuxWatcherDevTypeFilter(ctx, filter.DevType) != 0)
+                return false;
+
+            foreach (string tag in filter.Tags)
+            {
+                if (AddLinuxWatcherTagFilter(ctx, tag) != 0)
+                    return false;
+            }
+
+            foreach (UsbDeviceId deviceId in filter.DeviceIds)
+            {
+                if (AddLinuxWatcherIdFilter(ctx, deviceId.VendorID, deviceId.ProductID ?? -1) != 0)
+                    return false;
+            }
+
+            return true;
+        }
+
+        private enum LinuxWatcherEventKind
+        {
+            None,
+            Inserted,
+            Removed,
+            MountPointChanged
+        }
+
+        // Large enough for the biggest UsbDeviceRecord and for a syspath with a mount point
+        private const int LinuxWatcherEventBufferSize = 8192;
+
+        // Events that are already queued are raised together in UsbDevicesChanged, up to this many
+        private const int LinuxWatcherEventBatchSize = 256;
+
+        // Runs on its own thread while the event queue is enabled, until the watcher is stopped and the queue is empty
+        private unsafe void ReadLinuxWatcherEvents()
+        {
+            byte[] buffer = new byte[LinuxWatcherEventBufferSize];
+
+            fixed (byte* data = buffer)
+            {
+                while (true)
+                {
+                    // A negative result is an error that waiting again would not fix
+                    LinuxWatcherEventKind kind = (LinuxWatcherEventKind)ReadLinuxWatcherEvent(_linuxWatcherContext, (IntPtr)data, buffer.Length, -1);
+                    if (kind <= LinuxWatcherEventKind.None)
+                        return;
+
+                    BeginDeviceChangeBatch();
+
+                    try
+                    {
+                        // Keep reading without waiting while events are queued
+                        for (int count = 0; kind > LinuxWatcherEventKind.None; count++)
+                        {
+                            HandleLinuxWatcherEvent(kind, data);
+
+                            if (count + 1 >= LinuxWatcherEventBatchSize)
+                                break;
+
+                            kind = (LinuxWatcherEventKind)ReadLinuxWatcherEvent(_linuxWatcherContext, (IntPtr)data, buffer.Length, 0);
+                        }
+                    }
+                    finally
+                    {
+                        EndDeviceChangeBatch();
+                    }
+
+                    if (kind < LinuxWatcherEventKind.None)
+                        return;
+                }
+            }
+        }
+
+        private unsafe void HandleLinuxWatcherEvent(LinuxWatcherEventKind kind, byte* data)
+        {
+            switch (kind)
+            {
+                case LinuxWatcherEventKind.Inserted:
+                    InsertedRecordCallback((IntPtr)data);
+                    break;
+
+                case LinuxWatcherEventKind.Removed:
+                    RemovedRecordCallback((IntPtr)data);
+                    break;
+
+                case LinuxWatcherEventKind.MountPointChanged:
+                    // The device changes before the mount point are raised first, as the native batch does
+                    FlushDeviceChangeBatch();
+
+                    // The syspath and the mount point follow each other, both NUL-terminated
+                    int syspathLength = 0;
+                    while (data[syspathLength] != 0)
+                        syspathLength++;
+
+                    byte* mountPoint = data + syspathLength + 1;
+                    int mountPointLength = 0;
+                    while (mountPoint[mountPointLength] != 0)
+                        mountPointLength++;
+
+                    MountPointChanged(Encoding.UTF8.GetString(data, syspathLength), Encoding.UTF8.GetString(mountPoint, mountPointLength));
+                    break;
+            }
+        }
+
+        private void MountPointChanged(string syspath, string mountPoint)
+        {
+            foreach (UsbDevice usbDevice in Devices.FindBySystemPath(syspath))
+            {
+                SetMountPoint(usbDevice, mountPoint);
+            }
+        }
         
         [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
-        static extern void GetLinuxMountPoint(string syspath, MountPointCallback mountPointCallback);
+        static extern IntPtr CreateLinuxWatcherContext(UsbDeviceRecordCallback insertedCallback, UsbDeviceRecordCallback removedCallback, MountPointChangedCallback mountPointChangedCallback, bool includeTTY);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void SetLinuxWatcherFieldMask(IntPtr ctx, uint fieldMask);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void SetLinuxWatcherCoalesceDevices(IntPtr ctx, bool coalesceDevices);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void SetLinuxWatcherEnumerationThreads(IntPtr ctx, int threads);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern int SetLinuxWatcherSysfsFastPath(IntPtr ctx, bool enabled);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void GetLinuxDescriptionCacheStats(out ulong hits, out ulong misses, IntPtr count);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void SetLinuxWatcherDebounce(IntPtr ctx, int debounceMs);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern ulong GetLinuxWatcherSuppressedEvents(IntPtr ctx);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern int SetLinuxWatcherEventQueue(IntPtr ctx, int capacity, int overflowPolicy);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern int ReadLinuxWatcherEvent(IntPtr ctx, IntPtr buffer, int bufferSize, int timeoutMs);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern ulong GetLinuxWatcherQueueOverflows(IntPtr ctx);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void SetLinuxWatcherBatchCallback(IntPtr ctx, UsbDeviceBatchCallback batchCallback);
 
         [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
-        static extern void StartLinuxWatcher(UsbDeviceCallback insertedCallback, UsbDeviceCallback removedCallback, bool includeTTY);
+        static extern void SetLinuxWatcherReceiveBufferSize(IntPtr ctx, int receiveBufferSize);
 
         [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
-        static extern void StopLinuxWatcher();
+        static extern ulong GetLinuxWatcherResyncs(IntPtr ctx);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void GetLinuxWatcherStats(IntPtr ctx, out LinuxWatcherStats stats);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern int SetLinuxWatcherRecordFile(IntPtr ctx, string path);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern int SetLinuxWatcherReplayFile(IntPtr ctx, string path, bool maxSpeed);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern int SetLinuxWatcherDevTypeFilter(IntPtr ctx, string devtype);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern int AddLinuxWatcherTagFilter(IntPtr ctx, string tag);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern int AddLinuxWatcherIdFilter(IntPtr ctx, int vendorId, int productId);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern int SnapshotLinuxDevices(IntPtr ctx, out IntPtr records, out int size);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void FreeLinuxDeviceSnapshot(IntPtr records);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void RunLinuxWatcher(IntPtr ctx);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void StopLinuxWatcher(IntPtr ctx);
+
+        [DllImport("UsbEventWatcher.Linux.so", CallingConvention = CallingConvention.Cdecl)]
+        static extern void ReleaseLinuxWatcherContext(IntPtr ctx);
         
         
         [DllImport("UsbEventWatcher.Mac.dylib", CallingConvention = CallingConvention.Cdecl)]
@@ -308,7 +894,7 @@ namespace Usb.Events
                     usbDevice.IsEjected = false;
                     usbDevice.IsMounted = true;
 
-                    UsbDeviceList.Add(usbDevice);
+                    Devices.Add(usbDevice);
                 }
             }
         }
@@ -369,7 +955,7 @@ namespace Usb.Events
 
             if (inserted)
             {
-                foreach (UsbDevice usbDevice in UsbDeviceList.Where(device => device.MountedDirectoryPath == driveName))
+                foreach (UsbDevice usbDevice in Devices.Snapshot.Where(device => device.MountedDirectoryPath == driveName))
                 {
                     usbDevice.IsEjected = false;
                     usbDevice.IsMounted = true;
@@ -380,7 +966,7 @@ namespace Usb.Events
 
             if (removed)
             {
-                foreach (UsbDevice usbDevice in UsbDeviceList.Where(device => device.MountedDirectoryPath == driveName))
+                foreach (UsbDevice usbDevice in Devices.Snapshot.Where(device => device.MountedDirectoryPath == driveName))
                 {
                     usbDevice.IsEjected = true;
                     usbDevice.IsMounted = false;
@@ -526,9 +1112,9 @@ namespace Usb.Events
             UsbDevice usbDevice = new UsbDevice
             {
                 DeviceSystemPath = PnPEntityDeviceID,
-                ProductID = productId,
-                SerialNumber = serial,
-                VendorID = vendorId
+                ProductID = UsbDeviceStringPool.Intern(productId),
+                SerialNumber = UsbDeviceStringPool.Intern(serial),
+                VendorID = UsbDeviceStringPool.Intern(vendorId)
             };
 
             // TODO::
@@ -586,10 +1172,10 @@ namespace Usb.Events
                 if (getPnPEntityData)
                 {
                     usbDevice.DeviceName = entity["Caption"]?.ToString()?.Trim() ?? string.Empty;
-                    usbDevice.Product = entity["Description"]?.ToString()?.Trim() ?? string.Empty;
-                    usbDevice.ProductDescription = entity["Description"]?.ToString()?.Trim() ?? string.Empty;
-                    usbDevice.Vendor = entity["Manufacturer"]?.ToString()?.Trim() ?? string.Empty;
-                    usbDevice.VendorDescription = entity["Manufacturer"]?.ToString()?.Trim() ?? string.Empty;
+                    usbDevice.Product = UsbDeviceStringPool.Intern(entity["Description"]?.ToString()?.Trim());
+                    usbDevice.ProductDescription = usbDevice.Product;
+                    usbDevice.Vendor = UsbDeviceStringPool.Intern(entity["Manufacturer"]?.ToString()?.Trim());
+                    usbDevice.VendorDescription = usbDevice.Vendor;
                 }
 
                 string ClassGuid = entity["ClassGuid"]?.ToString()?.Trim() ?? string.Empty;
@@ -772,6 +1358,9 @@ namespace Usb.Events
         /// </summary>
         public void Dispose()
         {
+            // First, so that a watcher waiting for room in the channel can stop
+            _eventChannel?.Writer.TryComplete();
+
             if (RuntimeInformation.IsOSPlatform(OSPlatform.Windows))
             {
                 _volumeChangeEventWatcher?.Stop();
@@ -831,36 +1420,46 @@ namespace Usb.Events
             }
             else if (RuntimeInformation.IsOSPlatform(OSPlatform.Linux))
             {
-                _cancellationTokenSource?.Cancel();
+                if (_linuxWatcherContext != IntPtr.Zero)
+                {
+                    StopLinuxWatcher(_linuxWatcherContext);
+                }
 
-                if (_mountPointTask != null && !_mountPointTask.IsCompleted)
+                if (_watcherTask != null && !_watcherTask.IsCompleted)
                 {
                     try
                     {
-                        _mountPointTask.GetAwaiter().GetResult();
+                        _watcherTask.GetAwaiter().GetResult();
                     }
                     catch
                     {
                     }
                 }
 
-                _cancellationTokenSource?.Dispose();
-                _cancellationTokenSource = null;
-
-                StopLinuxWatcher();
-
-                if (_watcherTask != null && !_watcherTask.IsCompleted)
+                // The reader returns once the events that were queued before the stop are handled
+                if (_eventQueueTask != null && !_eventQueueTask.IsCompleted)
                 {
                     try
                     {
-                        _watcherTask.GetAwaiter().GetResult();
+                        _eventQueueTask.GetAwaiter().GetResult();
                     }
                     catch
                     {
                     }
                 }
+
+                // Released only after the event loop and the reader have exited, they still use the context until then
+                if (_linuxWatcherContext != IntPtr.Zero)
+                {
+                    ReleaseLinuxWatcherContext(_linuxWatcherContext);
+                    _linuxWatcherContext = IntPtr.Zero;
+                }
             }
 
+            // After the watchers have stopped, so that no more events are posted, the queued ones still run
+            _dispatcher?.Dispose();
+            _dispatcher = null;
+
             _isRunning = false;
         }
     }
@@ -0,0 +1,101 @@
+﻿using System;
+using System.Threading.Channels;
+
+namespace Usb.Events
+{
+    /// <summary>
+    /// Options for starting a UsbEventWatcher
+    /// </summary>
+    public class UsbEventWatcherOptions
+    {
+        /// <summary>
+        /// Set AddAlreadyPresentDevicesToList to true to include already present devices in Devices
+        /// </summary>
+        public bool AddAlreadyPresentDevicesToList { get; set; }
+
+        /// <summary>
+        /// Set UsePnPEntity to true to query Win32_PnPEntity instead of Win32_USBControllerDevice in Windows
+        /// </summary>
+        public bool UsePnPEntity { get; set; }
+
+        /// <summary>
+        /// Set IncludeTTY to true to monitor the TTY subsystem in Linux (besides the USB subsystem)
+        /// </summary>
+        public bool IncludeTTY { get; set; }
+
+        /// <summary>
+        /// UsbDevice properties to read in Linux, DeviceName and DeviceSystemPath are always read and the others are left empty
+        /// </summary>
+        public UsbDeviceFields Fields { get; set; } = UsbDeviceFields.All;
+
+        /// <summary>
+        /// Linux device filter, null reports all devices
+        /// </summary>
+        public UsbDeviceFilter? Filter { get; set; }
+
+        /// <summary>
+        /// Set CoalesceDevices to true to report each physical device once in Linux: events of its interfaces and child devices (such as TTYs) are reported as its usb_device
+        /// </summary>
+        public bool CoalesceDevices { get; set; }
+
+        /// <summary>
+        /// Number of threads that read the devices in Linux at startup, after lost events and for GetSnapshot(), each with its own udev context (1 reads them on the watcher thread)
+        /// </summary>
+        public int EnumerationThreads { get; set; } = 1;
+
+        /// <summary>
+        /// Set UseSysfsFastPath to true to read the vendor, product and serial number in Linux directly from the sysfs attributes of the USB device instead of through libudev
+        /// </summary>
+        public bool UseSysfsFastPath { get; set; }
+
+        /// <summary>
+        /// Debounce window in Linux: add and remove events of a device are held until none arrived for this long, then only the net change is reported (zero disables it)
+        /// </summary>
+        public TimeSpan DebounceWindow { get; set; } = TimeSpan.Zero;
+
+        /// <summary>
+        /// Capacity of the Linux event queue: when greater than zero, events are handled on a separate thread so that slow event handlers do not stall the native monitor (zero handles them on the monitor thread)
+        /// </summary>
+        public int EventQueueCapacity { get; set; }
+
+        /// <summary>
+        /// What the Linux event queue does when it is full
+        /// </summary>
+        public UsbEventQueueOverflowPolicy EventQueueOverflowPolicy { get; set; } = UsbEventQueueOverflowPolicy.DropOldest;
+
+        /// <summary>
+        /// Size in bytes of the udev netlink socket buffer in Linux (zero keeps the system default), events that do not fit are dropped by the kernel and recovered by re-enumerating the devices
+        /// </summary>
+        public int ReceiveBufferSize { get; set; }
+
+        /// <summary>
+        /// Capacity of the EventReader channel, every event is also written to it when greater than zero (zero disables it)
+        /// </summary>
+        public int EventChannelCapacity { get; set; }
+
+        /// <summary>
+        /// What the EventReader channel does when it is full, Wait blocks the reader of the event queue until the consumer reads an event and needs EventQueueCapacity in Linux, it is not allowed otherwise
+        /// </summary>
+        public BoundedChannelFullMode EventChannelFullMode { get; set; } = BoundedChannelFullMode.DropOldest;
+
+        /// <summary>
+        /// Number of threads that run the UsbDeviceAdded and UsbDeviceRemoved handlers: the events of one device run in order on the same thread, different devices run in parallel (zero runs them on the watcher thread)
+        /// </summary>
+        public int DispatcherThreads { get; set; }
+
+        /// <summary>
+        /// Path of an event log that every udev message received in Linux is written to, for a later replay with ReplayFile (null records nothing)
+        /// </summary>
+        public string? RecordFile { get; set; }
+
+        /// <summary>
+        /// Path of an event log written with RecordFile, whose messages are fed through the Linux watcher like received ones instead of enumerating and monitoring the devices of the host, no events are received once it has been replayed
+        /// </summary>
+        public string? ReplayFile { get; set; }
+
+        /// <summary>
+        /// Set ReplayAtMaximumSpeed to true to replay ReplayFile as fast as possible instead of at the recorded pace
+        /// </summary>
+        public bool ReplayAtMaximumSpeed { get; set; }
+    }
+}
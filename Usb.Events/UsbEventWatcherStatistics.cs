@@ -0,0 +1,144 @@
+﻿using System.Runtime.InteropServices;
+
+namespace Usb.Events
+{
+    /// <summary>
+    /// Counters and latency histograms of a Linux watcher, all zero on other platforms
+    /// </summary>
+    public sealed class UsbEventWatcherStatistics
+    {
+        internal UsbEventWatcherStatistics()
+        {
+            InitializedLatency = new UsbLatencyHistogram(new long[UsbLatencyHistogram.BucketCount]);
+            DispatchLatency = new UsbLatencyHistogram(new long[UsbLatencyHistogram.BucketCount]);
+        }
+
+        internal unsafe UsbEventWatcherStatistics(in LinuxWatcherStats stats)
+        {
+            EventsReceived = (long)stats.EventsReceived;
+            EventsFiltered = (long)stats.EventsFiltered;
+            EventsCoalesced = (long)stats.EventsCoalesced;
+            EventsSuppressed = (long)stats.EventsSuppressed;
+            EventsDropped = (long)stats.EventsDropped;
+            EventsDispatched = (long)stats.EventsDispatched;
+            Resyncs = (long)stats.Resyncs;
+            AddActions = (long)stats.AddActions;
+            RemoveActions = (long)stats.RemoveActions;
+            ChangeActions = (long)stats.ChangeActions;
+            BindActions = (long)stats.BindActions;
+            UnbindActions = (long)stats.UnbindActions;
+            OtherActions = (long)stats.OtherActions;
+
+            long[] initialized = new long[UsbLatencyHistogram.BucketCount];
+            long[] dispatch = new long[UsbLatencyHistogram.BucketCount];
+
+            fixed (ulong* initializedLatency = stats.InitializedLatency, dispatchLatency = stats.DispatchLatency)
+            {
+                for (int i = 0; i < UsbLatencyHistogram.BucketCount; i++)
+                {
+                    initialized[i] = (long)initializedLatency[i];
+                    dispatch[i] = (long)dispatchLatency[i];
+                }
+            }
+
+            InitializedLatency = new UsbLatencyHistogram(initialized);
+            DispatchLatency = new UsbLatencyHistogram(dispatch);
+        }
+
+        /// <summary>
+        /// Events read from the udev monitor
+        /// </summary>
+        public long EventsReceived { get; }
+
+        /// <summary>
+        /// Received events that were not reported: without a device node, not matching the filter, or with another action than add or remove
+        /// </summary>
+        public long EventsFiltered { get; }
+
+        /// <summary>
+        /// Events folded into their usb_device by CoalesceDevices, or replaced in the event queue by a newer event of the same device
+        /// </summary>
+        public long EventsCoalesced { get; }
+
+        /// <summary>
+        /// Add and remove events that were collapsed by the debounce window
+        /// </summary>
+        public long EventsSuppressed { get; }
+
+        /// <summary>
+        /// Events that the event queue discarded
+        /// </summary>
+        public long EventsDropped { get; }
+
+        /// <summary>
+        /// Device events that were passed to the application, including the enumerated devices
+        /// </summary>
+        public long EventsDispatched { get; }
+
+        /// <summary>
+        /// Number of times the devices were re-enumerated because udev events were lost
+        /// </summary>
+        public long Resyncs { get; }
+
+        /// <summary>
+        /// Received events with the add action
+        /// </summary>
+        public long AddActions { get; }
+
+        /// <summary>
+        /// Received events with the remove action
+        /// </summary>
+        public long RemoveActions { get; }
+
+        /// <summary>
+        /// Received events with the change action
+        /// </summary>
+        public long ChangeActions { get; }
+
+        /// <summary>
+        /// Received events with the bind action
+        /// </summary>
+        public long BindActions { get; }
+
+        /// <summary>
+        /// Received events with the unbind action
+        /// </summary>
+        public long UnbindActions { get; }
+
+        /// <summary>
+        /// Received events with other actions (move, online, offline)
+        /// </summary>
+        public long OtherActions { get; }
+
+        /// <summary>
+        /// Latency of add events from udev initializing the device to their receive by the watcher
+        /// </summary>
+        public UsbLatencyHistogram InitializedLatency { get; }
+
+        /// <summary>
+        /// Latency of received device events from their receive to their dispatch to the application, including the debounce window and the time in the event queue
+        /// </summary>
+        public UsbLatencyHistogram DispatchLatency { get; }
+    }
+
+    // WatcherStats of the Linux library
+    [StructLayout(LayoutKind.Sequential)]
+    internal unsafe struct LinuxWatcherStats
+    {
+        public ulong EventsReceived;
+        public ulong EventsFiltered;
+        public ulong EventsCoalesced;
+        public ulong EventsSuppressed;
+        public ulong EventsDropped;
+        public ulong EventsDispatched;
+        public ulong Resyncs;
+        public ulong AddActions;
+        public ulong RemoveActions;
+        public ulong ChangeActions;
+        public ulong BindActions;
+        public ulong UnbindActions;
+        public ulong OtherActions;
+        public fixed ulong InitializedLatency[UsbLatencyHistogram.BucketCount];
+        public fixed ulong DispatchLatency[UsbLatencyHistogram.BucketCount];
+    }
+}
@@ -0,0 +1,81 @@
+﻿using System;
+using System.Collections.Generic;
+
+namespace Usb.Events
+{
+    /// <summary>
+    /// Log-linear latency histogram, like an HDR histogram with two significant bits: latencies below 4 µs have a bucket each, every power of two above is split into 4 buckets
+    /// </summary>
+    public sealed class UsbLatencyHistogram
+    {
+        /// <summary>
+        /// Number of buckets, the last one also counts everything above its range (about 2 hours)
+        /// </summary>
+        public const int BucketCount = 128;
+
+        private const int SubBucketBits = 2;
+
+        private readonly long[] _counts;
+
+        internal UsbLatencyHistogram(long[] counts)
+        {
+            _counts = counts;
+
+            foreach (long count in counts)
+                Count += count;
+        }
+
+        /// <summary>
+        /// Number of recorded latencies
+        /// </summary>
+        public long Count { get; }
+
+        /// <summary>
+        /// Number of latencies in each bucket
+        /// </summary>
+        public IReadOnlyList<long> Counts => _counts;
+
+        /// <summary>
+        /// Smallest latency of a bucket
+        /// </summary>
+        /// <param name="bucket">Bucket index, up to BucketCount</param>
+        public static TimeSpan GetBucketLowerBound(int bucket)
+        {
+            if (bucket < 0 || bucket > BucketCount)
+                throw new ArgumentOutOfRangeException(nameof(bucket));
+
+            long microseconds = bucket < (1 << SubBucketBits)
+                ? bucket
+                : (long)((1 << SubBucketBits) | (bucket & ((1 << SubBucketBits) - 1))) << ((bucket >> SubBucketBits) - 1);
+
+            return TimeSpan.FromTicks(microseconds * (TimeSpan.TicksPerMillisecond / 1000));
+        }
+
+        /// <summary>
+        /// Latency below which the given percentage of the recorded latencies fall, rounded up to the end of its bucket
+        /// </summary>
+        /// <param name="percentile">Percentage between 0 and 100, for example 99.9</param>
+        /// <returns>The upper bound of the bucket, TimeSpan.Zero if no latency was recorded</returns>
+        public TimeSpan GetPercentile(double percentile)
+        {
+            if (percentile < 0 || percentile > 100)
+                throw new ArgumentOutOfRangeException(nameof(percentile));
+
+            if (Count == 0)
+                return TimeSpan.Zero;
+
+            long rank = Math.Max(1, (long)Math.Ceiling(Count * percentile / 100));
+            long total = 0;
+
+            for (int bucket = 0; bucket < _counts.Length; bucket++)
+            {
+                total += _counts[bucket];
+
+                if (total >= rank)
+                    return GetBucketLowerBound(bucket + 1);
+            }
+
+            return GetBucketLowerBound(BucketCount);
+        }
+    }
+}
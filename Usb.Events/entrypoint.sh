@@ -45,4 +45,4 @@ else
 fi
 
 # Execute the gcc command with the selected architecture and flags
-gcc $gcc_arch $gcc_flags UsbEventWatcher.Linux.c -o UsbEventWatcher.Linux.so -ludev -fPIC
\ No newline at end of file
+gcc $gcc_arch $gcc_flags UsbEventWatcher.Linux.c -o UsbEventWatcher.Linux.so -ludev -pthread -fPIC
\ No newline at end of file